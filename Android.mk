@@ -5,7 +5,7 @@ LOCAL_PATH := $(call my-dir)
 
 include $(CLEAR_VARS)
 LOCAL_PROPRIETARY_MODULE    := true
-LOCAL_SRC_FILES             := si_flash.c si46xx.c si46xx_props.c spi.c crc32.c i2c.c
+LOCAL_SRC_FILES             := si_flash.c si46xx.c si46xx_props.c spi.c crc32.c i2c.c gpio.c sim.c trace.c wait.c fwpipe.c fwlz.c fwinfo.c prof.c
 LOCAL_MODULE                := si_flash
 LOCAL_MODULE_TAGS           := optional
 LOCAL_C_INCLUDES            := $(LOCAL_PATH)
@@ -13,9 +13,23 @@ include $(BUILD_EXECUTABLE)
 
 include $(CLEAR_VARS)
 LOCAL_PROPRIETARY_MODULE    := true
-LOCAL_SRC_FILES             := si_ctl.c si46xx.c si46xx_props.c spi.c i2c.c
+LOCAL_SRC_FILES             := si_ctl.c si46xx.c si46xx_props.c spi.c crc32.c i2c.c gpio.c sim.c trace.c wait.c fwpipe.c fwlz.c fwinfo.c prof.c
 LOCAL_MODULE                := si_ctl
 LOCAL_MODULE_TAGS           := optional
 LOCAL_C_INCLUDES            := $(LOCAL_PATH)
 include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES             := si_bundle.c si46xx_props.c crc32.c fwinfo.c fwlz.c
+LOCAL_MODULE                := si_bundle
+LOCAL_MODULE_TAGS           := optional
+LOCAL_C_INCLUDES            := $(LOCAL_PATH)
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES             := si_lz.c fwlz.c crc32.c fwinfo.c
+LOCAL_MODULE                := si_lz
+LOCAL_MODULE_TAGS           := optional
+LOCAL_C_INCLUDES            := $(LOCAL_PATH)
+include $(BUILD_HOST_EXECUTABLE)
 endif # Include only for Renesas ones.
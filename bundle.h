@@ -0,0 +1,61 @@
+#ifndef _BUNDLE_H_
+#define _BUNDLE_H_
+
+#include <stdint.h>
+
+/*
+ * Boot bundle: patch, firmware and property writes of one mode as
+ * ready-to-send command frames, built by si_bundle. All fields are
+ * little endian, records are padded to 4 bytes.
+ *
+ *	header
+ *	BUNDLE_SECTION patch	LOAD_INIT, HOST_LOAD frames, settle wait
+ *	BUNDLE_SECTION image	LOAD_INIT, HOST_LOAD frames, BOOT
+ *	BUNDLE_SECTION props	SET_PROPERTY frames
+ */
+#define BUNDLE_MAGIC		"SI46BNDL"
+#define BUNDLE_VERSION		1
+#define BUNDLE_ALIGN		4
+#define BUNDLE_PAD(len)		(((len) + BUNDLE_ALIGN - 1) & ~(BUNDLE_ALIGN - 1))
+/* HOST_LOAD data per frame, frame fits one spidev transfer (bufsiz 4096) */
+#define BUNDLE_CHUNK_DEFAULT	4092
+#define BUNDLE_CHUNK_MAX	4096
+
+struct bundle_header {
+	char magic[8];
+	uint16_t version;
+	uint8_t mode;		/* SI46XX_MODE_* */
+	uint8_t reserved;
+	uint16_t chunk;		/* HOST_LOAD data bytes per frame */
+	uint16_t reserved2;
+	uint32_t records;
+	uint32_t size;		/* bytes of records */
+	uint32_t crc;		/* crc32 of records */
+} __attribute__((packed));
+
+/* record kinds */
+#define BUNDLE_SECTION		1	/* struct bundle_section */
+#define BUNDLE_CMD		2	/* frame, wait for reply */
+#define BUNDLE_LOAD		3	/* HOST_LOAD frame, reply checked later */
+#define BUNDLE_WAIT		4	/* uint32_t us since last frame */
+
+struct bundle_record {
+	uint8_t kind;
+	uint8_t reserved;
+	uint16_t len;		/* payload, without padding */
+} __attribute__((packed));
+
+/* section types */
+#define BUNDLE_SEC_PATCH	1
+#define BUNDLE_SEC_IMAGE	2
+#define BUNDLE_SEC_PROPS	3
+
+/* source file of section, for the firmware manifest */
+struct bundle_section {
+	uint8_t type;
+	uint8_t reserved[3];
+	uint32_t crc;		/* crc32 of file */
+	char name[24];
+} __attribute__((packed));
+
+#endif /* _BUNDLE_H_ */
@@ -0,0 +1,22 @@
+#ifndef _BUS_H_
+#define _BUS_H_
+
+#include <stdint.h>
+
+/*
+ * Transport to Si46xx, selected at si46xx_init()
+ */
+struct si46xx_bus {
+	const char *name;
+	/* send command frame */
+	int (*write)(const uint8_t *buf, int len);
+	/* RD_REPLY, reply is returned in data[1..cnt] */
+	int (*read_reply)(uint8_t *data, int cnt);
+	/* command frame and first RD_REPLY poll in one transaction, optional */
+	int (*command)(const uint8_t *buf, int len, uint8_t *data, int cnt);
+	/* send frame from separate header and data buffers, optional */
+	int (*write_gather)(const uint8_t *hdr, int hlen,
+		const uint8_t *data, int len);
+};
+
+#endif /* _BUS_H_ */
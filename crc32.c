@@ -40,10 +40,22 @@
  * CRC32 code derived from work by Gary S. Brown.
  */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <time.h>
+#if defined(__aarch64__) && defined(CRC32_ARMV8)
+#include <sys/auxv.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
 
-static uint32_t crc32_tab[] = {
+#include "crc32.h"
+
+static const uint32_t crc32_tab[] = {
 	0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
 	0xe963a535, 0x9e6495a3,	0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
 	0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91, 0x1db71064, 0x6ab020f2,
@@ -89,16 +101,339 @@ static uint32_t crc32_tab[] = {
 	0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
 };
 
+
+/*
+ * Kernels below work on the inverted crc register, crc32() does the
+ * inversion. All have to give the same result as the byte loop.
+ */
+static uint32_t
+crc32_byte(uint32_t crc, const uint8_t *p, size_t size)
+{
+	while (size--)
+		crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+/*
+ * Slice-by-N: crc32_slice[k][b] is the crc of byte b followed by k zero
+ * bytes, so N bytes are folded with N independent lookups
+ */
+static uint32_t crc32_slice[16][256];
+
+static void
+crc32_slice_init(void)
+{
+	int i;
+	int k;
+
+	for (i = 0; i < 256; i++)
+		crc32_slice[0][i] = crc32_tab[i];
+	for (k = 1; k < 16; k++)
+		for (i = 0; i < 256; i++)
+			crc32_slice[k][i] = (crc32_slice[k - 1][i] >> 8) ^
+				crc32_tab[crc32_slice[k - 1][i] & 0xFF];
+}
+
+static uint32_t
+load_u32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+#define SLICE4(w, k)	(crc32_slice[(k) + 3][(w) & 0xFF] ^ \
+			 crc32_slice[(k) + 2][((w) >> 8) & 0xFF] ^ \
+			 crc32_slice[(k) + 1][((w) >> 16) & 0xFF] ^ \
+			 crc32_slice[(k)][(w) >> 24])
+
+static uint32_t
+crc32_slice8(uint32_t crc, const uint8_t *p, size_t size)
+{
+	uint32_t w0;
+	uint32_t w1;
+
+	for (; size >= 8; size -= 8, p += 8) {
+		w0 = load_u32(p) ^ crc;
+		w1 = load_u32(p + 4);
+		crc = SLICE4(w0, 4) ^ SLICE4(w1, 0);
+	}
+	return crc32_byte(crc, p, size);
+}
+
+static uint32_t
+crc32_slice16(uint32_t crc, const uint8_t *p, size_t size)
+{
+	uint32_t w0;
+	uint32_t w1;
+	uint32_t w2;
+	uint32_t w3;
+
+	for (; size >= 16; size -= 16, p += 16) {
+		w0 = load_u32(p) ^ crc;
+		w1 = load_u32(p + 4);
+		w2 = load_u32(p + 8);
+		w3 = load_u32(p + 12);
+		crc = SLICE4(w0, 12) ^ SLICE4(w1, 8) ^ SLICE4(w2, 4) ^
+			SLICE4(w3, 0);
+	}
+	return crc32_byte(crc, p, size);
+}
+#endif
+
+#if defined(__aarch64__) && defined(CRC32_ARMV8)
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32		(1 << 7)
+#endif
+/*
+ * Not built unless CRC32_ARMV8 is defined: it has not been run on
+ * aarch64 yet, build with -DCRC32_ARMV8 and check with
+ * "si_flash --crc-bench" there before enabling it for good.
+ *
+ * The file is built for plain ARMv8, only this kernel enables CRC32.
+ * Target attribute syntax differs, and clang before 16 declares the
+ * arm_acle.h intrinsics only when the whole file targets +crc, so the
+ * builtins are called directly.
+ */
+#if defined(__clang__)
+#define CRC32_TARGET_CRC	__attribute__((target("crc")))
+#define crc32_armv8_b(crc, v)	__builtin_arm_crc32b(crc, v)
+#define crc32_armv8_d(crc, v)	__builtin_arm_crc32d(crc, v)
+#else
+#define CRC32_TARGET_CRC	__attribute__((target("+crc")))
+#define crc32_armv8_b(crc, v)	__builtin_aarch64_crc32b(crc, v)
+#define crc32_armv8_d(crc, v)	__builtin_aarch64_crc32x(crc, v)
+#endif
+
+/* ARMv8 CRC32 instructions, same reflected polynomial */
+CRC32_TARGET_CRC
+static uint32_t
+crc32_armv8(uint32_t crc, const uint8_t *p, size_t size)
+{
+	uint64_t v;
+
+	for (; (size) && ((uintptr_t)p & 7); size--)
+		crc = crc32_armv8_b(crc, *p++);
+	for (; size >= 8; size -= 8, p += 8) {
+		memcpy(&v, p, sizeof(v));
+		crc = crc32_armv8_d(crc, v);
+	}
+	while (size--)
+		crc = crc32_armv8_b(crc, *p++);
+	return crc;
+}
+
+static int
+crc32_armv8_ok(void)
+{
+	return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+#endif
+
+#if defined(__x86_64__)
+/*
+ * Carry-less multiply folding (Intel, "Fast CRC Computation for Generic
+ * Polynomials Using PCLMULQDQ"), constants for reflected 0xEDB88320:
+ * four 128 bit lanes are folded 64 bytes ahead, then into one, then
+ * Barrett reduced to 32 bits. Tail goes through slice-by-16.
+ */
+#define CRC32_PCLMUL_MIN	64
+
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t
+crc32_pclmul(uint32_t crc, const uint8_t *p, size_t size)
+{
+	const __m128i k1k2 = _mm_set_epi64x(0x1c6e41596, 0x154442bd4);
+	const __m128i k3k4 = _mm_set_epi64x(0x0ccaa009e, 0x1751997d0);
+	const __m128i k5 = _mm_set_epi64x(0, 0x163cd6124);
+	const __m128i poly = _mm_set_epi64x(0x1f7011641, 0x1db710641);
+	const __m128i mask32 = _mm_set_epi32(0, 0, 0, ~0);
+	__m128i x0, x1, x2, x3, t;
+
+	if (size < CRC32_PCLMUL_MIN)
+		return crc32_slice16(crc, p, size);
+
+	x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)p),
+		_mm_cvtsi32_si128(crc));
+	x1 = _mm_loadu_si128((const __m128i *)(p + 16));
+	x2 = _mm_loadu_si128((const __m128i *)(p + 32));
+	x3 = _mm_loadu_si128((const __m128i *)(p + 48));
+	p += 64;
+	size -= 64;
+
+#define FOLD(x, k, data) do {						\
+		t = _mm_clmulepi64_si128(x, k, 0x00);			\
+		x = _mm_clmulepi64_si128(x, k, 0x11);			\
+		x = _mm_xor_si128(_mm_xor_si128(x, t), data);		\
+	} while (0)
+
+	for (; size >= 64; size -= 64, p += 64) {
+		FOLD(x0, k1k2, _mm_loadu_si128((const __m128i *)p));
+		FOLD(x1, k1k2, _mm_loadu_si128((const __m128i *)(p + 16)));
+		FOLD(x2, k1k2, _mm_loadu_si128((const __m128i *)(p + 32)));
+		FOLD(x3, k1k2, _mm_loadu_si128((const __m128i *)(p + 48)));
+	}
+
+	FOLD(x0, k3k4, x1);
+	FOLD(x0, k3k4, x2);
+	FOLD(x0, k3k4, x3);
+	for (; size >= 16; size -= 16, p += 16)
+		FOLD(x0, k3k4, _mm_loadu_si128((const __m128i *)p));
+#undef FOLD
+
+	/* 128 -> 64 bits */
+	t = _mm_clmulepi64_si128(x0, k3k4, 0x10);
+	x0 = _mm_xor_si128(_mm_srli_si128(x0, 8), t);
+	/* 64 -> 32 bits */
+	t = _mm_srli_si128(x0, 4);
+	x0 = _mm_clmulepi64_si128(_mm_and_si128(x0, mask32), k5, 0x00);
+	x0 = _mm_xor_si128(x0, t);
+	/* Barrett reduction */
+	t = x0;
+	x0 = _mm_clmulepi64_si128(_mm_and_si128(x0, mask32), poly, 0x10);
+	x0 = _mm_clmulepi64_si128(_mm_and_si128(x0, mask32), poly, 0x00);
+	x0 = _mm_xor_si128(x0, t);
+	crc = _mm_extract_epi32(x0, 1);
+
+	return crc32_slice16(crc, p, size);
+}
+
+static int
+crc32_pclmul_ok(void)
+{
+	unsigned int a, b, c, d;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d))
+		return 0;
+	return (c & bit_PCLMUL) && (c & bit_SSE4_1);
+}
+#endif
+
+/* fastest first */
+static const struct crc32_impl {
+	const char *name;
+	uint32_t (*fn)(uint32_t crc, const uint8_t *p, size_t size);
+	int (*ok)(void);
+} crc32_impls[] = {
+#if defined(__aarch64__) && defined(CRC32_ARMV8)
+	{ "armv8",	crc32_armv8,	crc32_armv8_ok },
+#endif
+#if defined(__x86_64__)
+	{ "pclmul",	crc32_pclmul,	crc32_pclmul_ok },
+#endif
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	{ "slice16",	crc32_slice16,	NULL },
+	{ "slice8",	crc32_slice8,	NULL },
+#endif
+	{ "byte",	crc32_byte,	NULL },
+};
+#define CRC32_IMPLS	(sizeof(crc32_impls) / sizeof(crc32_impls[0]))
+
+static const struct crc32_impl *crc32_cur = &crc32_impls[CRC32_IMPLS - 1];
+
+/* tables and kernel chosen before main, no locking on the hot path */
+__attribute__((constructor))
+static void
+crc32_init(void)
+{
+	unsigned int i;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	crc32_slice_init();
+#endif
+	for (i = 0; i < CRC32_IMPLS; i++) {
+		if ((crc32_impls[i].ok == NULL) || (crc32_impls[i].ok())) {
+			crc32_cur = &crc32_impls[i];
+			break;
+		}
+	}
+}
+
 uint32_t
 crc32(uint32_t crc, const void *buf, size_t size)
 {
-	const uint8_t *p;
+	return crc32_cur->fn(crc ^ ~0U, buf, size) ^ ~0U;
+}
+
+const char *
+crc32_impl_name(void)
+{
+	return crc32_cur->name;
+}
 
-	p = buf;
-	crc = crc ^ ~0U;
+#define CRC32_CHECK_LEN		4096
+#define CRC32_BENCH_LEN		(1 << 20)
+#define CRC32_BENCH_ROUNDS	64
 
-	while (size--)
-		crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+static uint64_t
+crc32_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Check every usable kernel against the byte loop on all lengths up to
+ * CRC32_CHECK_LEN at shifting alignment and seed, then time each.
+ * Returns -1 on a mismatch.
+ */
+int
+crc32_bench(void)
+{
+	const struct crc32_impl *impl;
+	uint8_t *buf;
+	uint32_t seed = 0x12345678;
+	uint32_t ref;
+	uint32_t got;
+	uint64_t start;
+	uint64_t ns;
+	size_t len;
+	unsigned int i;
+	unsigned int r;
+	int ret = 0;
+
+	buf = malloc(CRC32_BENCH_LEN + 16);
+	if (buf == NULL)
+		return -1;
+	for (len = 0; len < CRC32_BENCH_LEN + 16; len++) {
+		seed = seed * 1103515245 + 12345;
+		buf[len] = seed >> 16;
+	}
+
+	printf("crc32 kernel in use: %s\n", crc32_cur->name);
+	for (i = 0; i < CRC32_IMPLS; i++) {
+		impl = &crc32_impls[i];
+		if ((impl->ok) && (!impl->ok())) {
+			printf("%-8s not supported\n", impl->name);
+			continue;
+		}
+		for (len = 0; len <= CRC32_CHECK_LEN; len++) {
+			seed = len * 0x9e3779b9;
+			ref = crc32_byte(seed, buf + len % 16, len);
+			got = impl->fn(seed, buf + len % 16, len);
+			if (got != ref) {
+				printf("%-8s MISMATCH len %zu: 0x%08x != 0x%08x\n",
+					impl->name, len, got, ref);
+				ret = -1;
+				break;
+			}
+		}
+		if (len <= CRC32_CHECK_LEN)
+			continue;
+
+		start = crc32_now_ns();
+		for (r = 0; r < CRC32_BENCH_ROUNDS; r++)
+			ref = impl->fn(ref, buf + r % 16, CRC32_BENCH_LEN);
+		ns = crc32_now_ns() - start;
+		printf("%-8s ok, %8.1f MB/s\n", impl->name,
+			(double)CRC32_BENCH_LEN * CRC32_BENCH_ROUNDS * 1000.0 /
+			(ns ? ns : 1));
+	}
+	free(buf);
 
-	return crc ^ ~0U;
-}
\ No newline at end of file
+	return ret;
+}
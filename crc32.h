@@ -0,0 +1,16 @@
+#ifndef _CRC32_H_
+#define _CRC32_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Standard crc32 (reflected 0xEDB88320, inverted in and out), chained
+ * by passing the previous result as crc. Fastest kernel of the CPU is
+ * picked at startup.
+ */
+uint32_t crc32(uint32_t crc, const void *buf, size_t size);
+const char *crc32_impl_name(void);
+int crc32_bench(void);
+
+#endif /* _CRC32_H_ */
@@ -0,0 +1,444 @@
+/*
+ * Firmware manifest - what was booted last and how to recognize it
+ *
+ * The chip does not report which image it runs beyond GET_FUNC_INFO
+ * revision, so the revision read after each boot is stored together
+ * with the identity of the image it came from. Image files are
+ * identified by crc, only recalculated when size or mtime changed. A
+ * running image matching its entry does not have to be loaded again, a
+ * file changed since the boot has to.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fwinfo.h"
+#include "crc32.h"
+#include "fwlz.h"
+
+static struct fw_info fw_infos[FW_INFO_MAX];
+static int fw_info_num;
+static int fw_manifest_dirty;
+
+/*
+ * One "<name> <size> <mtime> <crc> <rev crc> <rev> <boot us>" line per
+ * image, rev is "-" when not known
+ */
+int fw_manifest_load(const char *path)
+{
+	char line[128];
+	char rev[2 * FW_INFO_REV_LEN + 1];
+	struct fw_info *info;
+	long long mtime;
+	unsigned int val;
+	FILE *fp;
+	int i;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return -errno;
+
+	fw_info_num = 0;
+	while (fgets(line, sizeof(line), fp) &&
+	       (fw_info_num < FW_INFO_MAX)) {
+		info = &fw_infos[fw_info_num];
+		memset(info, 0, sizeof(*info));
+		/* boot time is missing in older manifests */
+		if (sscanf(line, "%31s %u %lld %x %x %16s %u", info->name,
+				&info->size, &mtime, &info->crc,
+				&info->rev_crc, rev, &info->boot_us) < 6)
+			continue;
+		if (info->name[0] == '#')
+			continue;
+		info->mtime = mtime;
+		if (strlen(rev) == 2 * FW_INFO_REV_LEN) {
+			for (i = 0; i < FW_INFO_REV_LEN; i++) {
+				if (sscanf(&rev[2 * i], "%2x", &val) != 1)
+					break;
+				info->rev[i] = val;
+			}
+			info->rev_valid = i == FW_INFO_REV_LEN;
+		}
+		fw_info_num++;
+	}
+	fclose(fp);
+	fw_manifest_dirty = 0;
+
+	return 0;
+}
+
+int fw_manifest_save(const char *path)
+{
+	struct fw_info *info;
+	FILE *fp;
+	int i;
+	int j;
+
+	if (!fw_manifest_dirty)
+		return 0;
+
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		printf("Can not write %s: %s\n", path, strerror(errno));
+		return -errno;
+	}
+	fprintf(fp, "# si46xx firmware: name size mtime crc "
+		"booted_crc revision boot_us\n");
+	for (i = 0; i < fw_info_num; i++) {
+		info = &fw_infos[i];
+		fprintf(fp, "%s %u %lld %08x %08x ", info->name, info->size,
+			(long long)info->mtime, info->crc, info->rev_crc);
+		if (info->rev_valid) {
+			for (j = 0; j < FW_INFO_REV_LEN; j++)
+				fprintf(fp, "%02x", info->rev[j]);
+		} else {
+			fprintf(fp, "-");
+		}
+		fprintf(fp, " %u\n", info->boot_us);
+	}
+	fclose(fp);
+	fw_manifest_dirty = 0;
+
+	return 0;
+}
+
+struct fw_info *fw_info_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < fw_info_num; i++)
+		if (strcmp(fw_infos[i].name, name) == 0)
+			return &fw_infos[i];
+	return NULL;
+}
+
+/*
+ * Entry by name, a new one is added if missing. When the table is full
+ * the oldest entry is dropped.
+ */
+struct fw_info *fw_info_get(const char *name)
+{
+	struct fw_info *info;
+
+	info = fw_info_find(name);
+	if (info)
+		return info;
+
+	if (fw_info_num == FW_INFO_MAX) {
+		memmove(&fw_infos[0], &fw_infos[1],
+			(FW_INFO_MAX - 1) * sizeof(fw_infos[0]));
+		fw_info_num--;
+	}
+	info = &fw_infos[fw_info_num++];
+	memset(info, 0, sizeof(*info));
+	snprintf(info->name, sizeof(info->name), "%s", name);
+	fw_manifest_dirty = 1;
+
+	return info;
+}
+
+/*
+ * Crc of image in file, of a compressed container that of the image it
+ * holds, so packing does not change identity
+ */
+static int fw_file_crc(const char *path, uint32_t size, uint32_t *crc)
+{
+	struct fwlz_header hdr;
+	void *map;
+	int fd;
+
+	*crc = 0;
+	if (size == 0)
+		return 0;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	if ((pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr)) &&
+	    (fwlz_header_check(&hdr) == 0)) {
+		close(fd);
+		*crc = hdr.crc;
+		return 0;
+	}
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -errno;
+	madvise(map, size, MADV_SEQUENTIAL);
+	*crc = crc32(0, map, size);
+	munmap(map, size);
+
+	return 0;
+}
+
+/*
+ * Whole file in a malloc()ed buffer, NULL if missing or empty
+ */
+uint8_t *fw_file_read(const char *path, uint32_t *size)
+{
+	uint8_t *buf;
+	FILE *fp;
+	long len;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL) {
+		printf("Can not open %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	buf = (len > 0) ? malloc(len) : NULL;
+	if ((buf == NULL) || (fread(buf, 1, len, fp) != (size_t)len)) {
+		printf("Can not read %s\n", path);
+		free(buf);
+		fclose(fp);
+		return NULL;
+	}
+	fclose(fp);
+	*size = len;
+	return buf;
+}
+
+/*
+ * Entry of image file dir/name, or of its compressed container
+ * dir/name.lz if only that exists, brought up to date with the file
+ */
+struct fw_info *fw_info_file(const char *dir, const char *name)
+{
+	char path[256];
+	struct fw_info *info;
+	struct stat st;
+	int64_t mtime;
+	uint32_t crc;
+
+	snprintf(path, sizeof(path), "%s%s", dir, name);
+	if (stat(path, &st) < 0) {
+		snprintf(path, sizeof(path), "%s%s%s", dir, name,
+			FWLZ_SUFFIX);
+		if (stat(path, &st) < 0)
+			return NULL;
+	}
+
+	mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	info = fw_info_get(name);
+	if ((info->size == (uint32_t)st.st_size) && (info->mtime == mtime))
+		return info;
+
+	if (fw_file_crc(path, st.st_size, &crc))
+		return NULL;
+	info->size = st.st_size;
+	info->mtime = mtime;
+	info->crc = crc;
+	fw_manifest_dirty = 1;
+
+	return info;
+}
+
+/*
+ * Entry of image known by crc only, e.g. from a boot bundle. If the crc
+ * changed, a file of that name is checked again when used next time.
+ */
+struct fw_info *fw_info_crc(const char *name, uint32_t crc)
+{
+	struct fw_info *info;
+
+	info = fw_info_get(name);
+	if (info->crc != crc) {
+		info->crc = crc;
+		info->size = 0;
+		info->mtime = 0;
+		fw_manifest_dirty = 1;
+	}
+	return info;
+}
+
+/*
+ * Entry of image known by its data, e.g. just written to flash
+ */
+struct fw_info *fw_info_data(const char *name, const void *buf,
+		uint32_t size)
+{
+	struct fw_info *info;
+
+	info = fw_info_crc(name, crc32(0, buf, size));
+	if (info->size != size) {
+		info->size = size;
+		fw_manifest_dirty = 1;
+	}
+	return info;
+}
+
+/* drop all entries starting with prefix */
+void fw_info_forget(const char *prefix)
+{
+	int i = 0;
+
+	while (i < fw_info_num) {
+		if (strncmp(fw_infos[i].name, prefix, strlen(prefix))) {
+			i++;
+			continue;
+		}
+		memmove(&fw_infos[i], &fw_infos[i + 1],
+			(fw_info_num - i - 1) * sizeof(fw_infos[0]));
+		fw_info_num--;
+		fw_manifest_dirty = 1;
+	}
+}
+
+static void fw_blocks_remove(const char *name)
+{
+	char path[256];
+
+	snprintf(path, sizeof(path), "%s.%s", FW_MANIFEST_PATH, name);
+	unlink(path);
+}
+
+/*
+ * Drop flash entries overlapping offset..offset+size, entries of unknown
+ * size may overlap anything, and their block crcs
+ */
+void fw_info_forget_flash(uint32_t offset, uint32_t size)
+{
+	unsigned int start;
+	int i = 0;
+
+	while (i < fw_info_num) {
+		if ((sscanf(fw_infos[i].name, "flash@%x", &start) != 1) ||
+		    ((fw_infos[i].size) &&
+		     ((start >= offset + size) ||
+		      (start + fw_infos[i].size <= offset)))) {
+			i++;
+			continue;
+		}
+		fw_blocks_remove(fw_infos[i].name);
+		memmove(&fw_infos[i], &fw_infos[i + 1],
+			(fw_info_num - i - 1) * sizeof(fw_infos[0]));
+		fw_info_num--;
+		fw_manifest_dirty = 1;
+	}
+}
+
+int fw_info_match(const struct fw_info *info, const uint8_t *rev)
+{
+	return (info) && (info->rev_valid) && (info->rev_crc == info->crc) &&
+		(memcmp(info->rev, rev, FW_INFO_REV_LEN) == 0);
+}
+
+void fw_info_set_rev(struct fw_info *info, const uint8_t *rev)
+{
+	if ((info->rev_valid) && (info->rev_crc == info->crc) &&
+	    (memcmp(info->rev, rev, FW_INFO_REV_LEN) == 0))
+		return;
+	memcpy(info->rev, rev, FW_INFO_REV_LEN);
+	info->rev_crc = info->crc;
+	info->rev_valid = 1;
+	fw_manifest_dirty = 1;
+}
+
+/*
+ * Averaged boot time, small changes are not worth a manifest write
+ */
+void fw_info_set_time(struct fw_info *info, uint32_t us)
+{
+	uint32_t avg = info->boot_us ? (3 * info->boot_us + us) / 4 : us;
+	uint32_t diff = avg > info->boot_us ? avg - info->boot_us :
+		info->boot_us - avg;
+
+	if (diff <= info->boot_us / 16)
+		return;
+	info->boot_us = avg;
+	fw_manifest_dirty = 1;
+}
+
+int fw_blocks_calc(struct fw_blocks *blocks, const void *buf, uint32_t size,
+		uint32_t block)
+{
+	const uint8_t *data = buf;
+	int i;
+
+	blocks->size = size;
+	blocks->block = block;
+	blocks->num = (size + block - 1) / block;
+	if (blocks->num > FW_BLOCKS_MAX)
+		return -E2BIG;
+	for (i = 0; i < blocks->num; i++)
+		blocks->crcs[i] = crc32(0, data + i * block,
+			fw_blocks_len(blocks, i));
+	blocks->crc = crc32(0, buf, size);
+	return 0;
+}
+
+/* bytes of block i, the last one may be short */
+uint32_t fw_blocks_len(const struct fw_blocks *blocks, int i)
+{
+	uint32_t pos = i * blocks->block;
+
+	return blocks->size - pos < blocks->block ?
+		blocks->size - pos : blocks->block;
+}
+
+/*
+ * "<size> <block> <crc>" line, then one crc per block
+ */
+int fw_blocks_load(const char *name, struct fw_blocks *blocks)
+{
+	char path[256];
+	char line[64];
+	FILE *fp;
+	int ret = 0;
+	int i;
+
+	snprintf(path, sizeof(path), "%s.%s", FW_MANIFEST_PATH, name);
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return -errno;
+
+	do {
+		if (fgets(line, sizeof(line), fp) == NULL) {
+			ret = -EINVAL;
+			break;
+		}
+	} while (line[0] == '#');
+	if ((ret == 0) && ((sscanf(line, "%u %u %x", &blocks->size,
+			&blocks->block, &blocks->crc) != 3) ||
+	    (blocks->block == 0)))
+		ret = -EINVAL;
+	if (ret == 0) {
+		blocks->num = (blocks->size + blocks->block - 1) / blocks->block;
+		if (blocks->num > FW_BLOCKS_MAX)
+			ret = -EINVAL;
+	}
+	for (i = 0; (ret == 0) && (i < blocks->num); i++)
+		if (fscanf(fp, "%x", &blocks->crcs[i]) != 1)
+			ret = -EINVAL;
+	fclose(fp);
+
+	return ret;
+}
+
+int fw_blocks_save(const char *name, const struct fw_blocks *blocks)
+{
+	char path[256];
+	FILE *fp;
+	int i;
+
+	snprintf(path, sizeof(path), "%s.%s", FW_MANIFEST_PATH, name);
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		printf("Can not write %s: %s\n", path, strerror(errno));
+		return -errno;
+	}
+	fprintf(fp, "# si46xx flash blocks: size block crc, block crcs\n");
+	fprintf(fp, "%u %u %08x\n", blocks->size, blocks->block, blocks->crc);
+	for (i = 0; i < blocks->num; i++)
+		fprintf(fp, "%08x\n", blocks->crcs[i]);
+	fclose(fp);
+
+	return 0;
+}
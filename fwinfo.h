@@ -0,0 +1,67 @@
+#ifndef _FWINFO_H_
+#define _FWINFO_H_
+
+#include <stdint.h>
+
+#ifndef FW_MANIFEST_PATH
+#define FW_MANIFEST_PATH	"/data/vendor/si46xx/fw_manifest"
+#endif
+#define FW_INFO_MAX		16
+#define FW_INFO_NAME_LEN	32
+/* GET_FUNC_INFO reply without status */
+#define FW_INFO_REV_LEN		8
+/* name of image written to flash at offset */
+#define FW_INFO_FLASH		"flash@0x%06x"
+/* blocks of one flash image, 2 MiB of 2 KiB blocks */
+#define FW_BLOCKS_MAX		1024
+
+/*
+ * Manifest entry: identity of an image file (size, mtime, crc) or flash
+ * offset ("flash@0x006000") and the GET_FUNC_INFO revision the chip
+ * reported after it was booted last time, with crc of file at that time.
+ * Flash entries know size and crc only when written by si_flash.
+ */
+struct fw_info {
+	char name[FW_INFO_NAME_LEN];
+	uint32_t size;
+	int64_t mtime;		/* ns */
+	uint32_t crc;
+	uint32_t rev_crc;
+	uint8_t rev[FW_INFO_REV_LEN];
+	int rev_valid;
+	uint32_t boot_us;	/* load and BOOT, 0 if never measured */
+};
+
+/*
+ * Crc of each block of an image as written to flash, kept in a file
+ * next to the manifest per flash entry
+ */
+struct fw_blocks {
+	uint32_t size;		/* image bytes */
+	uint32_t block;		/* bytes per block */
+	uint32_t crc;		/* crc32 of image */
+	int num;
+	uint32_t crcs[FW_BLOCKS_MAX];
+};
+
+uint8_t *fw_file_read(const char *path, uint32_t *size);
+int fw_manifest_load(const char *path);
+int fw_manifest_save(const char *path);
+struct fw_info *fw_info_get(const char *name);
+struct fw_info *fw_info_file(const char *dir, const char *name);
+struct fw_info *fw_info_find(const char *name);
+struct fw_info *fw_info_crc(const char *name, uint32_t crc);
+struct fw_info *fw_info_data(const char *name, const void *buf,
+		uint32_t size);
+void fw_info_forget(const char *prefix);
+void fw_info_forget_flash(uint32_t offset, uint32_t size);
+void fw_info_set_time(struct fw_info *info, uint32_t us);
+int fw_blocks_calc(struct fw_blocks *blocks, const void *buf, uint32_t size,
+		uint32_t block);
+uint32_t fw_blocks_len(const struct fw_blocks *blocks, int i);
+int fw_blocks_load(const char *name, struct fw_blocks *blocks);
+int fw_blocks_save(const char *name, const struct fw_blocks *blocks);
+int fw_info_match(const struct fw_info *info, const uint8_t *rev);
+void fw_info_set_rev(struct fw_info *info, const uint8_t *rev);
+
+#endif /* _FWINFO_H_ */
@@ -0,0 +1,195 @@
+/*
+ * Firmware codec - small LZ77, byte oriented, no external dependency
+ *
+ * A block is a list of sequences:
+ *
+ *	token		literal count << 4 | (match length - 4)
+ *	[count]		255 bytes while more, when token count is 15
+ *	literals
+ *	offset		2 bytes, distance back in output
+ *	[length]	255 bytes while more, when token length is 15
+ *
+ * The last sequence has literals only and ends at the end of the block.
+ * Decoding is copying only, so it keeps ahead of the bus easily.
+ */
+#include <string.h>
+#include <errno.h>
+
+#include "fwlz.h"
+
+#define FWLZ_MIN_MATCH		4
+#define FWLZ_MAX_OFFSET		65535
+#define FWLZ_HASH_BITS		14
+/* literals kept at the end of the block, match search stops there */
+#define FWLZ_TAIL		5
+
+static uint32_t get_u32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint32_t fwlz_hash(const uint8_t *p)
+{
+	return (get_u32(p) * 2654435761U) >> (32 - FWLZ_HASH_BITS);
+}
+
+/* token nibble value 15 continues in bytes of 255 */
+static uint8_t *put_len(uint8_t *op, uint32_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = len;
+	return op;
+}
+
+static uint8_t *put_seq(uint8_t *op, const uint8_t *lit, uint32_t lit_len,
+		uint32_t offset, uint32_t match_len)
+{
+	uint8_t *token = op++;
+	uint32_t ml = match_len ? match_len - FWLZ_MIN_MATCH : 0;
+
+	*token = (lit_len < 15 ? lit_len : 15) << 4;
+	if (lit_len >= 15)
+		op = put_len(op, lit_len - 15);
+	memcpy(op, lit, lit_len);
+	op += lit_len;
+	if (!match_len)
+		return op;
+
+	*op++ = offset & 0xFF;
+	*op++ = offset >> 8;
+	*token |= ml < 15 ? ml : 15;
+	if (ml >= 15)
+		op = put_len(op, ml - 15);
+	return op;
+}
+
+/*
+ * Greedy compression of one block, returns compressed length or 0 when
+ * it does not fit into cap bytes
+ */
+int fwlz_compress(const uint8_t *src, int len, uint8_t *dst, int cap)
+{
+	uint32_t table[1 << FWLZ_HASH_BITS];
+	const uint8_t *ip = src;
+	const uint8_t *anchor = src;
+	const uint8_t *end = src + len;
+	const uint8_t *limit = end - FWLZ_TAIL;
+	const uint8_t *ref;
+	uint8_t *op = dst;
+	uint32_t h;
+	uint32_t match;
+	uint32_t lit;
+
+	memset(table, 0xFF, sizeof(table));
+	while ((len > FWLZ_TAIL) && (ip < limit)) {
+		h = fwlz_hash(ip);
+		ref = table[h] == 0xFFFFFFFF ? NULL : src + table[h];
+		table[h] = ip - src;
+		if ((ref == NULL) || (ip - ref > FWLZ_MAX_OFFSET) ||
+		    (get_u32(ip) != get_u32(ref))) {
+			ip++;
+			continue;
+		}
+
+		match = FWLZ_MIN_MATCH;
+		while ((ip + match < limit) && (ip[match] == ref[match]))
+			match++;
+
+		/* worst case: token, lengths, literals, offset */
+		lit = ip - anchor;
+		if ((op - dst) + 1 + lit / 255 + 1 + lit + 2 + match / 255 + 1 >
+				(uint32_t)cap)
+			return 0;
+		op = put_seq(op, anchor, lit, ip - ref, match);
+		ip += match;
+		anchor = ip;
+	}
+
+	lit = end - anchor;
+	if ((op - dst) + 1 + lit / 255 + 1 + lit > (uint32_t)cap)
+		return 0;
+	op = put_seq(op, anchor, lit, 0, 0);
+
+	return op - dst;
+}
+
+static int get_len(const uint8_t **ip, const uint8_t *end, uint32_t *len)
+{
+	uint8_t b;
+
+	do {
+		if (*ip >= end)
+			return -EINVAL;
+		b = *(*ip)++;
+		*len += b;
+	} while (b == 255);
+	return 0;
+}
+
+/*
+ * Returns decompressed length, -EINVAL on corrupt data or when output
+ * would exceed cap bytes
+ */
+int fwlz_decompress(const uint8_t *src, int len, uint8_t *dst, int cap)
+{
+	const uint8_t *ip = src;
+	const uint8_t *end = src + len;
+	uint8_t *op = dst;
+	uint8_t *op_end = dst + cap;
+	const uint8_t *ref;
+	uint32_t lit;
+	uint32_t match;
+	uint32_t offset;
+	uint8_t token;
+
+	while (ip < end) {
+		token = *ip++;
+
+		lit = token >> 4;
+		if ((lit == 15) && (get_len(&ip, end, &lit)))
+			return -EINVAL;
+		if ((lit > (uint32_t)(end - ip)) ||
+		    (lit > (uint32_t)(op_end - op)))
+			return -EINVAL;
+		memcpy(op, ip, lit);
+		ip += lit;
+		op += lit;
+		if (ip == end)
+			break;
+
+		if (end - ip < 2)
+			return -EINVAL;
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		match = token & 0x0F;
+		if ((match == 15) && (get_len(&ip, end, &match)))
+			return -EINVAL;
+		match += FWLZ_MIN_MATCH;
+		if ((offset == 0) || (offset > (uint32_t)(op - dst)) ||
+		    (match > (uint32_t)(op_end - op)))
+			return -EINVAL;
+
+		/* may overlap, byte order matters */
+		ref = op - offset;
+		while (match--)
+			*op++ = *ref++;
+	}
+
+	return op - dst;
+}
+
+int fwlz_header_check(const struct fwlz_header *hdr)
+{
+	if (memcmp(hdr->magic, FWLZ_MAGIC, sizeof(hdr->magic)))
+		return -EINVAL;
+	if ((hdr->version != FWLZ_VERSION) || (hdr->block == 0) ||
+	    (hdr->block > FWLZ_BLOCK))
+		return -EINVAL;
+	return 0;
+}
@@ -0,0 +1,43 @@
+#ifndef _FWLZ_H_
+#define _FWLZ_H_
+
+#include <stdint.h>
+
+/*
+ * Compressed firmware container, built by si_lz. All fields are little
+ * endian.
+ *
+ *	header
+ *	block header, data	repeated, each block FWLZ_BLOCK bytes of
+ *				image, the last one less
+ *
+ * Blocks are compressed on their own, so they can be unpacked one at a
+ * time while the previous one is sent. Blocks that do not shrink are
+ * stored.
+ */
+#define FWLZ_MAGIC		"SILZ"
+#define FWLZ_VERSION		1
+#define FWLZ_SUFFIX		".lz"
+#define FWLZ_BLOCK		65536
+/* block data stored, not compressed */
+#define FWLZ_STORED		0x80000000
+
+struct fwlz_header {
+	char magic[4];
+	uint16_t version;
+	uint16_t reserved;
+	uint32_t size;		/* image bytes */
+	uint32_t crc;		/* crc32 of image */
+	uint32_t block;		/* image bytes per block */
+} __attribute__((packed));
+
+struct fwlz_block {
+	uint32_t len;		/* data bytes, FWLZ_STORED if not compressed */
+	uint32_t crc;		/* crc32 of image bytes of block */
+} __attribute__((packed));
+
+int fwlz_compress(const uint8_t *src, int len, uint8_t *dst, int cap);
+int fwlz_decompress(const uint8_t *src, int len, uint8_t *dst, int cap);
+int fwlz_header_check(const struct fwlz_header *hdr);
+
+#endif /* _FWLZ_H_ */
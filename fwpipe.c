@@ -0,0 +1,327 @@
+/*
+ * Firmware read pipeline for HOST_LOAD from cold storage
+ *
+ * With the image not in page cache every chunk sent from a mapping
+ * first waits for storage, and the bus is idle meanwhile. Here a reader
+ * thread pread()s chunks into a ring of page aligned buffers ahead of
+ * the bus thread, so reading and sending overlap. Stall counters tell
+ * which side had to wait. Compressed containers are unpacked by the
+ * reader thread as well.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "fwpipe.h"
+#include "crc32.h"
+#include "fwlz.h"
+#include "wait.h"
+
+/*
+ * Part of file in page cache, percent
+ */
+int fw_file_resident(int fd, off_t size)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	size_t pages = (size + page - 1) / page;
+	unsigned char *vec;
+	size_t resident = 0;
+	size_t i;
+	void *map;
+
+	if (size == 0)
+		return 100;
+
+	map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		return -errno;
+	vec = malloc(pages);
+	if (vec == NULL) {
+		munmap(map, size);
+		return -ENOMEM;
+	}
+	if (mincore(map, size, vec) == 0) {
+		for (i = 0; i < pages; i++)
+			resident += vec[i] & 1;
+	} else {
+		/* unknown, take as cached */
+		resident = pages;
+	}
+	free(vec);
+	munmap(map, size);
+
+	return resident * 100 / pages;
+}
+
+/*
+ * Free slot to fill, -1 when stopped
+ */
+static int fw_pipe_slot(struct fw_pipe *fwp)
+{
+	uint64_t start;
+	int slot = -1;
+
+	pthread_mutex_lock(&fwp->lock);
+	if ((fwp->head - fwp->tail == FW_PIPE_SLOTS) && (!fwp->stop)) {
+		start = wait_now();
+		fwp->bus_stalls++;
+		while ((fwp->head - fwp->tail == FW_PIPE_SLOTS) &&
+		       (!fwp->stop))
+			pthread_cond_wait(&fwp->cond, &fwp->lock);
+		fwp->bus_stall_us += wait_now() - start;
+	}
+	if (!fwp->stop)
+		slot = fwp->head % FW_PIPE_SLOTS;
+	pthread_mutex_unlock(&fwp->lock);
+
+	return slot;
+}
+
+/* slot filled with len bytes, or reading failed with err */
+static void fw_pipe_fill(struct fw_pipe *fwp, int slot, int len, int err)
+{
+	pthread_mutex_lock(&fwp->lock);
+	if (err < 0) {
+		fwp->err = err;
+	} else {
+		fwp->len[slot] = len;
+		fwp->head++;
+	}
+	pthread_cond_broadcast(&fwp->cond);
+	pthread_mutex_unlock(&fwp->lock);
+}
+
+static int fw_pipe_pread(int fd, void *buf, int len, off_t offset)
+{
+	int ret;
+
+	ret = pread(fd, buf, len, offset);
+	if (ret < 0)
+		return -errno;
+	if (ret != len)
+		return -EIO;
+	return 0;
+}
+
+static void *fw_pipe_reader(void *arg)
+{
+	struct fw_pipe *fwp = arg;
+	off_t offset = 0;
+	int slot;
+	int len;
+	int ret;
+
+	while (offset < fwp->size) {
+		slot = fw_pipe_slot(fwp);
+		if (slot < 0)
+			break;
+
+		len = fwp->size - offset < fwp->chunk ?
+			fwp->size - offset : fwp->chunk;
+		ret = fw_pipe_pread(fwp->fd, fwp->buf + slot * fwp->chunk, len,
+			offset);
+		fw_pipe_fill(fwp, slot, len, ret);
+		if (ret < 0)
+			break;
+		offset += len;
+	}
+
+	return NULL;
+}
+
+/*
+ * Compressed container: blocks are read and unpacked here, then handed
+ * out in chunks, so unpacking overlaps with the bus too. A block is
+ * checked before any of it is sent.
+ */
+static void *fw_pipe_reader_lz(void *arg)
+{
+	struct fw_pipe *fwp = arg;
+	struct fwlz_block blk;
+	off_t offset = sizeof(struct fwlz_header);
+	off_t done = 0;
+	uint32_t data_len;
+	uint32_t block;
+	int slot;
+	int pos;
+	int len;
+	int ret = 0;
+
+	while ((done < fwp->size) && (ret == 0)) {
+		block = fwp->size - done < fwp->lz_block ?
+			fwp->size - done : fwp->lz_block;
+
+		ret = fw_pipe_pread(fwp->fd, &blk, sizeof(blk), offset);
+		if (ret)
+			break;
+		offset += sizeof(blk);
+		data_len = blk.len & ~FWLZ_STORED;
+		if (data_len > ((blk.len & FWLZ_STORED) ? block : FWLZ_BLOCK)) {
+			ret = -EINVAL;
+			break;
+		}
+
+		if (blk.len & FWLZ_STORED) {
+			ret = fw_pipe_pread(fwp->fd, fwp->lz_out, data_len,
+				offset);
+			len = data_len;
+		} else {
+			ret = fw_pipe_pread(fwp->fd, fwp->lz_in, data_len,
+				offset);
+			if (ret == 0)
+				len = fwlz_decompress(fwp->lz_in, data_len,
+					fwp->lz_out, block);
+		}
+		if (ret)
+			break;
+		offset += data_len;
+		if (((uint32_t)len != block) ||
+		    (crc32(0, fwp->lz_out, block) != blk.crc)) {
+			printf("Corrupt block @%lld\n", (long long)done);
+			ret = -EINVAL;
+			break;
+		}
+
+		for (pos = 0; pos < (int)block; pos += len) {
+			slot = fw_pipe_slot(fwp);
+			if (slot < 0)
+				return NULL;
+			len = block - pos < (uint32_t)fwp->chunk ?
+				(int)block - pos : fwp->chunk;
+			memcpy(fwp->buf + slot * fwp->chunk,
+				fwp->lz_out + pos, len);
+			fw_pipe_fill(fwp, slot, len, 0);
+		}
+		done += block;
+	}
+	if (ret)
+		fw_pipe_fill(fwp, 0, 0, ret);
+
+	return NULL;
+}
+
+static int fw_pipe_run(struct fw_pipe *fwp, int fd, off_t size, int chunk,
+		void *(*reader)(void *))
+{
+	long page = sysconf(_SC_PAGESIZE);
+	int ret;
+
+	fwp->fd = fd;
+	fwp->size = size;
+	fwp->chunk = chunk;
+
+	ret = posix_memalign((void **)&fwp->buf, page, FW_PIPE_SLOTS * chunk);
+	if (ret)
+		return -ret;
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	pthread_mutex_init(&fwp->lock, NULL);
+	pthread_cond_init(&fwp->cond, NULL);
+	ret = pthread_create(&fwp->thread, NULL, reader, fwp);
+	if (ret) {
+		pthread_cond_destroy(&fwp->cond);
+		pthread_mutex_destroy(&fwp->lock);
+		free(fwp->buf);
+		return -ret;
+	}
+
+	return 0;
+}
+
+int fw_pipe_start(struct fw_pipe *fwp, int fd, off_t size, int chunk)
+{
+	memset(fwp, 0, sizeof(*fwp));
+	return fw_pipe_run(fwp, fd, size, chunk, fw_pipe_reader);
+}
+
+/*
+ * Pipeline of image in compressed container fd, chunks are unpacked
+ * image data
+ */
+int fw_pipe_start_lz(struct fw_pipe *fwp, int fd,
+		const struct fwlz_header *hdr, int chunk)
+{
+	int ret;
+
+	memset(fwp, 0, sizeof(*fwp));
+	fwp->lz_block = hdr->block;
+	fwp->lz_in = malloc(FWLZ_BLOCK);
+	fwp->lz_out = malloc(FWLZ_BLOCK);
+	if ((fwp->lz_in == NULL) || (fwp->lz_out == NULL)) {
+		ret = -ENOMEM;
+	} else {
+		ret = fw_pipe_run(fwp, fd, hdr->size, chunk,
+			fw_pipe_reader_lz);
+		if (ret == 0)
+			return 0;
+	}
+	free(fwp->lz_in);
+	free(fwp->lz_out);
+	return ret;
+}
+
+/*
+ * Next chunk in file order, returns its length, 0 at end of file
+ */
+int fw_pipe_get(struct fw_pipe *fwp, const uint8_t **data)
+{
+	unsigned int slot;
+	uint64_t start;
+	int ret;
+
+	pthread_mutex_lock(&fwp->lock);
+	if ((fwp->head == fwp->tail) && (!fwp->err) &&
+	    (fwp->sent < fwp->size)) {
+		start = wait_now();
+		fwp->storage_stalls++;
+		while ((fwp->head == fwp->tail) && (!fwp->err))
+			pthread_cond_wait(&fwp->cond, &fwp->lock);
+		fwp->storage_stall_us += wait_now() - start;
+	}
+	if (fwp->head != fwp->tail) {
+		slot = fwp->tail % FW_PIPE_SLOTS;
+		*data = fwp->buf + slot * fwp->chunk;
+		ret = fwp->len[slot];
+	} else {
+		ret = fwp->err;
+	}
+	pthread_mutex_unlock(&fwp->lock);
+
+	return ret;
+}
+
+/*
+ * Chunk from fw_pipe_get() is sent, slot can be refilled
+ */
+void fw_pipe_put(struct fw_pipe *fwp)
+{
+	pthread_mutex_lock(&fwp->lock);
+	fwp->sent += fwp->len[fwp->tail % FW_PIPE_SLOTS];
+	fwp->tail++;
+	pthread_cond_broadcast(&fwp->cond);
+	pthread_mutex_unlock(&fwp->lock);
+}
+
+void fw_pipe_stop(struct fw_pipe *fwp)
+{
+	pthread_mutex_lock(&fwp->lock);
+	fwp->stop = 1;
+	pthread_cond_broadcast(&fwp->cond);
+	pthread_mutex_unlock(&fwp->lock);
+	pthread_join(fwp->thread, NULL);
+
+	printf("Load pipeline: %u chunks, waits on storage %u (%llu us), "
+		"on bus %u (%llu us)\n", fwp->tail,
+		fwp->storage_stalls, (unsigned long long)fwp->storage_stall_us,
+		fwp->bus_stalls, (unsigned long long)fwp->bus_stall_us);
+
+	pthread_cond_destroy(&fwp->cond);
+	pthread_mutex_destroy(&fwp->lock);
+	free(fwp->buf);
+	free(fwp->lz_in);
+	free(fwp->lz_out);
+}
@@ -0,0 +1,53 @@
+#ifndef _FWPIPE_H_
+#define _FWPIPE_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "fwlz.h"
+
+/* chunks read ahead of the bus */
+#define FW_PIPE_SLOTS		8
+/* below this part of image in page cache, pipeline is used */
+#define FW_PIPE_COLD_PERCENT	50
+
+/*
+ * Firmware read pipeline: reader thread fills a ring of chunk buffers
+ * from file, the bus thread takes them in order
+ */
+struct fw_pipe {
+	int fd;
+	off_t size;
+	int chunk;
+	uint8_t *buf;
+	/* compressed container */
+	uint32_t lz_block;
+	uint8_t *lz_in;
+	uint8_t *lz_out;
+	int len[FW_PIPE_SLOTS];
+	unsigned int head;	/* next slot to fill */
+	unsigned int tail;	/* next slot to send */
+	off_t sent;		/* bytes of slots sent */
+	int err;
+	int stop;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+	/* bus waiting for data: storage is the bottleneck */
+	unsigned int storage_stalls;
+	uint64_t storage_stall_us;
+	/* reader waiting for free slot: bus is the bottleneck */
+	unsigned int bus_stalls;
+	uint64_t bus_stall_us;
+};
+
+int fw_file_resident(int fd, off_t size);
+int fw_pipe_start(struct fw_pipe *fwp, int fd, off_t size, int chunk);
+int fw_pipe_start_lz(struct fw_pipe *fwp, int fd,
+		const struct fwlz_header *hdr, int chunk);
+int fw_pipe_get(struct fw_pipe *fwp, const uint8_t **data);
+void fw_pipe_put(struct fw_pipe *fwp);
+void fw_pipe_stop(struct fw_pipe *fwp);
+
+#endif /* _FWPIPE_H_ */
@@ -0,0 +1,134 @@
+/*
+ * INTB line handling through the GPIO character device (uAPI v2)
+ *
+ * INTB is active low, falling edges are queued by the kernel, so an
+ * interrupt raised between sending a command and starting to wait is
+ * not lost. If INTB is held asserted by an unacknowledged interrupt no
+ * edge comes, callers check gpio_intb_asserted() before waiting.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+#include "gpio.h"
+
+extern int verbose;
+
+#define VERBOSE()	(verbose > 2)
+
+int gpio_intb_fd = 0;
+
+/*
+ * spec is "<chip>:<line>", chip is either a path or a name in /dev,
+ * e.g. "gpiochip0:12" or "/dev/gpiochip0:12"
+ */
+int gpio_intb_init(const char *spec)
+{
+	struct gpio_v2_line_request req;
+	char path[64];
+	const char *sep;
+	char *end;
+	long line;
+	int fd;
+	int ret;
+
+	sep = strrchr(spec, ':');
+	if (!sep || sep == spec) {
+		printf("Invalid INTB line %s, expected chip:line\n", spec);
+		return -EINVAL;
+	}
+	line = strtol(sep + 1, &end, 0);
+	if (*end || line < 0) {
+		printf("Invalid INTB line number %s\n", sep + 1);
+		return -EINVAL;
+	}
+	snprintf(path, sizeof(path), "%s%.*s",
+		spec[0] == '/' ? "" : "/dev/", (int)(sep - spec), spec);
+
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		printf("Unable to open GPIO chip %s: %s\n",
+			path, strerror(errno));
+		return -errno;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.offsets[0] = line;
+	req.num_lines = 1;
+	req.config.flags = GPIO_V2_LINE_FLAG_INPUT |
+			   GPIO_V2_LINE_FLAG_EDGE_FALLING;
+	strncpy(req.consumer, "si46xx-intb", sizeof(req.consumer) - 1);
+
+	ret = ioctl(fd, GPIO_V2_GET_LINE_IOCTL, &req);
+	close(fd);
+	if (ret < 0) {
+		printf("Unable to request INTB line %s:%ld: %s\n",
+			path, line, strerror(errno));
+		return -errno;
+	}
+
+	gpio_intb_fd = req.fd;
+	if (VERBOSE())
+		printf("INTB on %s line %ld\n", path, line);
+
+	return 0;
+}
+
+/*
+ * Return 1 if INTB is low, 0 if high, negative on error
+ */
+int gpio_intb_asserted(void)
+{
+	struct gpio_v2_line_values values;
+
+	if (!gpio_intb_fd)
+		return -ENODEV;
+
+	values.bits = 0;
+	values.mask = 1;
+	if (ioctl(gpio_intb_fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0)
+		return -errno;
+
+	return !(values.bits & 1);
+}
+
+/*
+ * Wait for INTB falling edge
+ *	returns 1 on edge, 0 on timeout, negative on error
+ */
+int gpio_intb_wait(int timeout_us)
+{
+	struct gpio_v2_line_event ev[16];
+	struct pollfd pfd;
+	struct timespec ts;
+	int ret;
+
+	if (!gpio_intb_fd)
+		return -ENODEV;
+
+	pfd.fd = gpio_intb_fd;
+	pfd.events = POLLIN;
+	ts.tv_sec = timeout_us / 1000000;
+	ts.tv_nsec = (timeout_us % 1000000) * 1000;
+
+	ret = ppoll(&pfd, 1, &ts, NULL);
+	if (ret < 0)
+		return -errno;
+	if (ret == 0)
+		return 0;
+
+	/* drain queued events, only the fact of the edge matters */
+	ret = read(gpio_intb_fd, ev, sizeof(ev));
+	if (ret < 0)
+		return -errno;
+
+	return 1;
+}
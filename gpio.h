@@ -0,0 +1,10 @@
+#ifndef _GPIO_H_
+#define _GPIO_H_
+
+extern int gpio_intb_fd;
+
+int gpio_intb_init(const char *spec);
+int gpio_intb_asserted(void);
+int gpio_intb_wait(int timeout_us);
+
+#endif /* _GPIO_H_ */
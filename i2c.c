@@ -12,15 +12,16 @@
 #include <fcntl.h>
 #include <errno.h>
 //#include "i2cbusses.h"
+#include <linux/i2c.h>
 #include <linux/i2c-dev.h>
 
 #include "i2c.h"
-
-extern int verbose;
-
-#define VERBOSE()	(verbose > 2)
+#include "trace.h"
 
 int i2c_fd = 0;
+static int i2c_addr;
+/* adapter supports combined transactions (I2C_RDWR) */
+static int i2c_rdwr;
 
 int i2c_parse_address(const char *address_arg)
 {
@@ -79,63 +80,102 @@ int set_slave_addr(int file, int address, int force)
 
 int i2c_io(unsigned char *out, int out_len, unsigned char *in, int in_len)
 {
-	int i;
 	int ret;
 
-	if (VERBOSE()) {
-		if (out) {
-			printf("(%04d)> ", out_len);
-			for (i = 0; i < MIN(out_len, 16); i++)
-				printf("%02x ", out[i]);
-			if (i != out_len)
-				printf("...");
-			printf("\n");
-		} else {
-			printf("(%04d)> NULL\n", out_len);
-		}
-	}
+	if (out)
+		trace_io(TRACE_TX, out, out_len);
+
+	if ((i2c_rdwr) && (out != NULL) && (out_len != 0) &&
+	    (in != NULL) && (in_len != 0)) {
+		/* write + repeated start + read, bus is not released */
+		struct i2c_msg msgs[2];
+		struct i2c_rdwr_ioctl_data rdwr;
+
+		msgs[0].addr = i2c_addr;
+		msgs[0].flags = 0;
+		msgs[0].len = out_len;
+		msgs[0].buf = out;
+		msgs[1].addr = i2c_addr;
+		msgs[1].flags = I2C_M_RD;
+		msgs[1].len = in_len;
+		msgs[1].buf = in;
+		rdwr.msgs = msgs;
+		rdwr.nmsgs = 2;
 
-	if ((out != NULL) && (out_len != 0)) {
-		ret = write(i2c_fd, out, out_len);
-		if (ret != out_len) {
-			printf("I2C write error %d: %s\n", errno, strerror(errno));
-			/* return -errno; */
-		}
-	}
-
-	if ((in != NULL) && (in_len != 0)) {
 		memset(in, 0, in_len);
-		ret = read(i2c_fd, in, in_len);
-		if (ret != in_len) {
-			printf("I2C read error %d: %s\n", errno, strerror(errno));
-			/* return -errno; */
+		ret = ioctl(i2c_fd, I2C_RDWR, &rdwr);
+		if (ret != 2) {
+			ret = ret < 0 ? -errno : -EIO;
+			printf("I2C transfer error %d: %s\n", -ret,
+				strerror(-ret));
+			return ret;
 		}
-	}
-	if (VERBOSE()) {
-		if (in) {
-			printf("(%04d)< ", in_len);
-			for (i = 0; i < MIN(in_len, 16); i++)
-				printf("%02x ", in[i]);
-			if (i != in_len)
-				printf("...");
-			printf("\n");
-		} else {
-			printf("(%04d)< NULL\n", in_len);
+	} else {
+		/* separate write and read, bus is released in between */
+		if ((out != NULL) && (out_len != 0)) {
+			ret = write(i2c_fd, out, out_len);
+			if (ret != out_len) {
+				ret = ret < 0 ? -errno : -EIO;
+				printf("I2C write error %d: %s\n", -ret,
+					strerror(-ret));
+				return ret;
+			}
+		}
+		if ((in != NULL) && (in_len != 0)) {
+			memset(in, 0, in_len);
+			ret = read(i2c_fd, in, in_len);
+			if (ret != in_len) {
+				ret = ret < 0 ? -errno : -EIO;
+				printf("I2C read error %d: %s\n", -ret,
+					strerror(-ret));
+				return ret;
+			}
 		}
 	}
+	if (in)
+		trace_io(TRACE_RX, in, in_len);
 	return 0;
 }
 
+/*
+ * Bus clock of adapter from device tree, i2c-dev has no way to change it
+ */
+static int i2c_adapter_speed(char *bus)
+{
+	char path[PATH_MAX];
+	unsigned char val[4];
+	char *name;
+	int fd;
+	int ret;
+
+	name = strrchr(bus, '/');
+	name = name ? name + 1 : bus;
+	snprintf(path, sizeof(path),
+		"/sys/class/i2c-dev/%s/device/of_node/clock-frequency", name);
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	ret = read(fd, val, sizeof(val));
+	close(fd);
+	if (ret != sizeof(val))
+		return -EIO;
+
+	/* big endian cell */
+	return (val[0] << 24) | (val[1] << 16) | (val[2] << 8) | val[3];
+}
+
 int i2c_init(char* bus, int addr, int speed)
 {
 	int fd ;
 	int ret;
-	char filename[20];
+	unsigned long funcs;
+	int bus_speed;
 
 	fd = i2c_open_dev(bus);
 	if (fd < 0) {
 		printf("Unable to open i2c device %s: %s\n",
-			filename, strerror(errno)) ;
+			bus, strerror(errno)) ;
 		return errno;
 	}
 
@@ -146,6 +186,18 @@ int i2c_init(char* bus, int addr, int speed)
 		return ret;
 	}
 
+	if ((ioctl(fd, I2C_FUNCS, &funcs) == 0) && (funcs & I2C_FUNC_I2C))
+		i2c_rdwr = 1;
+	else
+		printf("I2C adapter has no combined transfers, using read/write\n");
+
+	/* requested speed can only be checked against adapter clock */
+	bus_speed = i2c_adapter_speed(bus);
+	if ((speed > 0) && (bus_speed > 0) && (bus_speed != speed))
+		printf("I2C adapter runs at %d Hz instead of %d Hz\n",
+			bus_speed, speed);
+
+	i2c_addr = addr;
 	i2c_fd = fd;
 
 	return 0;
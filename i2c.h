@@ -1,7 +1,7 @@
 #ifndef _I2C_H_
 #define _I2C_H_
 
-int i2c_fd;
+extern int i2c_fd;
 
 int i2c_parse_address(const char *address_arg);
 int i2c_lookup_bus(const char *i2cbus_arg);
@@ -0,0 +1,155 @@
+/*
+ * Boot profiler - where the time to audio goes
+ *
+ * Phases of bring-up are timed with CLOCK_MONOTONIC and summed up per
+ * phase. At exit a table is printed and, if a file is given, the same
+ * rows are appended to it as CSV so runs can be compared. Disabled it
+ * costs one test per phase boundary.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "prof.h"
+#include "wait.h"
+
+static struct {
+	const char *name;
+	int once;		/* only first completion counts */
+	unsigned int count;
+	uint64_t begin;
+	uint64_t first;
+	uint64_t total;
+	uint64_t min;
+	uint64_t max;
+} prof_phases[PROF_NUM] = {
+	[PROF_POWERUP]		= { "powerup" },
+	[PROF_PATCH]		= { "patch" },
+	[PROF_LOAD_INIT]	= { "load_init" },
+	[PROF_HOST_LOAD]	= { "host_load" },
+	[PROF_IMAGE]		= { "image" },
+	[PROF_FLASH_ERASE]	= { "flash_erase" },
+	[PROF_FLASH_WRITE]	= { "flash_write" },
+	[PROF_FLASH_LOAD]	= { "flash_load" },
+	[PROF_BOOT]		= { "boot" },
+	[PROF_TUNE]		= { "first_tune", 1 },
+};
+
+static int prof_on;
+static uint64_t prof_start;
+static const char *prof_tool;
+static const char *prof_csv;
+
+void prof_begin(int phase)
+{
+	if (!prof_on)
+		return;
+	if ((prof_phases[phase].once) && (prof_phases[phase].count))
+		return;
+	prof_phases[phase].begin = wait_now();
+}
+
+void prof_end(int phase)
+{
+	uint64_t now;
+	uint64_t us;
+
+	if ((!prof_on) || (!prof_phases[phase].begin))
+		return;
+	now = wait_now();
+	us = now - prof_phases[phase].begin;
+
+	if (!prof_phases[phase].count) {
+		prof_phases[phase].first = prof_phases[phase].begin;
+		prof_phases[phase].min = us;
+	}
+	if (us < prof_phases[phase].min)
+		prof_phases[phase].min = us;
+	if (us > prof_phases[phase].max)
+		prof_phases[phase].max = us;
+	prof_phases[phase].total += us;
+	prof_phases[phase].count++;
+	prof_phases[phase].begin = 0;
+}
+
+/*
+ * One row per phase: time,tool,phase,count,start_us,total_us,min_us,max_us
+ */
+static void prof_write_csv(uint64_t end)
+{
+	FILE *fp;
+	time_t now = time(NULL);
+	int i;
+
+	fp = fopen(prof_csv, "a");
+	if (fp == NULL) {
+		printf("Can not write %s\n", prof_csv);
+		return;
+	}
+	fseek(fp, 0, SEEK_END);
+	if (ftell(fp) == 0)
+		fprintf(fp, "time,tool,phase,count,start_us,total_us,"
+			"min_us,max_us\n");
+	for (i = 0; i < PROF_NUM; i++) {
+		if (!prof_phases[i].count)
+			continue;
+		fprintf(fp, "%ld,%s,%s,%u,%llu,%llu,%llu,%llu\n",
+			(long)now, prof_tool, prof_phases[i].name,
+			prof_phases[i].count,
+			(unsigned long long)(prof_phases[i].first - prof_start),
+			(unsigned long long)prof_phases[i].total,
+			(unsigned long long)prof_phases[i].min,
+			(unsigned long long)prof_phases[i].max);
+	}
+	fprintf(fp, "%ld,%s,total,1,0,%llu,%llu,%llu\n", (long)now, prof_tool,
+		(unsigned long long)(end - prof_start),
+		(unsigned long long)(end - prof_start),
+		(unsigned long long)(end - prof_start));
+	fclose(fp);
+}
+
+static void prof_report(void)
+{
+	uint64_t end = wait_now();
+	int i;
+
+	printf("boot profile, ms:\n");
+	printf("%-12s %5s %10s %10s %10s %10s\n",
+		"phase", "count", "start", "total", "min", "max");
+	for (i = 0; i < PROF_NUM; i++) {
+		if (!prof_phases[i].count)
+			continue;
+		printf("%-12s %5u %10.3f %10.3f %10.3f %10.3f\n",
+			prof_phases[i].name, prof_phases[i].count,
+			(prof_phases[i].first - prof_start) / 1000.0,
+			prof_phases[i].total / 1000.0,
+			prof_phases[i].min / 1000.0,
+			prof_phases[i].max / 1000.0);
+	}
+	if (prof_phases[PROF_TUNE].count)
+		printf("time to first tune %.3f ms\n",
+			(prof_phases[PROF_TUNE].first +
+			 prof_phases[PROF_TUNE].total - prof_start) / 1000.0);
+	printf("total %.3f ms\n", (end - prof_start) / 1000.0);
+
+	if (prof_csv)
+		prof_write_csv(end);
+}
+
+/*
+ * Start profiling, times are relative to this call. Report is printed
+ * at exit, csv may be NULL.
+ */
+void prof_enable(const char *tool, const char *csv)
+{
+	const char *base = strrchr(tool, '/');
+
+	prof_tool = base ? base + 1 : tool;
+	prof_csv = csv;
+	prof_start = wait_now();
+	if (!prof_on)
+		atexit(prof_report);
+	prof_on = 1;
+}
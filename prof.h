@@ -0,0 +1,23 @@
+#ifndef _PROF_H_
+#define _PROF_H_
+
+/* bring-up phases, in boot order */
+enum {
+	PROF_POWERUP,
+	PROF_PATCH,		/* patch load */
+	PROF_LOAD_INIT,
+	PROF_HOST_LOAD,		/* each chunk */
+	PROF_IMAGE,		/* firmware image load */
+	PROF_FLASH_ERASE,
+	PROF_FLASH_WRITE,	/* each block */
+	PROF_FLASH_LOAD,
+	PROF_BOOT,
+	PROF_TUNE,		/* first successful tune */
+	PROF_NUM
+};
+
+void prof_enable(const char *tool, const char *csv);
+void prof_begin(int phase);
+void prof_end(int phase);
+
+#endif /* _PROF_H_ */
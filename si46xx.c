@@ -20,12 +20,53 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "crc32.h"
 #include "spi.h"
 #include "i2c.h"
+#include "gpio.h"
+#include "sim.h"
+#include "bus.h"
+#include "trace.h"
+#include "wait.h"
+#include "fwpipe.h"
+#include "fwlz.h"
+#include "fwinfo.h"
+#include "prof.h"
+#include "bundle.h"
 #include "si46xx.h"
 #include "si46xx_props.h"
 
 #define msleep(x) usleep(x*1000)
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof((x)[0]))
+
+/* CS high time between command frame and first RD_REPLY poll */
+#define SI46XX_CTS_GUARD_US	20
+
+/* RD_REPLY poll interval while waiting for CTS, doubled on each poll */
+#define SI46XX_POLL_MIN_US	20
+#define SI46XX_POLL_MAX_US	1000
+/* STCINT poll interval */
+#define SI46XX_STC_POLL_US	1000
+
+/* time budgets of loops waiting for the chip */
+#define SI46XX_DAB_TUNE_BUDGET_US	(2000 * 1000)
+#define SI46XX_DIGRAD_BUDGET_US		(100 * 1000)
+#define SI46XX_DIGRAD_RETRY_US		(10 * 1000)
+#define SI46XX_SERVICE_LIST_BUDGET_US	(1000 * 1000)
+#define SI46XX_SERVICE_LIST_RETRY_US	(10 * 1000)
+/* BOOT is sent again if it does not reach CTS within its budget */
+#define SI46XX_BOOT_TRIES		5
+
+//#define FW_LOAD_BUF	256
+#define FW_LOAD_BUF	4096
+#define MAX_BLOCK_SIZE	4084
+/* FLASH_LOAD write frame without data */
+#define FLASH_WRITE_HDR	16
+/* largest frame: HOST_LOAD or FLASH_LOAD write block with its header */
+#define SI46XX_FRAME_SIZE	(FW_LOAD_BUF + 4)
 
 #define RESET_GPIO	780
 #define MODE_GPIO	781
@@ -44,30 +85,180 @@
 	data[i++] = ((a) >> 24) & 0xff;	\
 	} while (0)
 
-#define CS_LOW()
-#define CS_HIGH()
 #define RESET_LOW()
 #define RESET_HIGH()
 
 #define MIN(a,b) (((a)<(b))?(a):(b))
 #define MAX(a,b) (((a)>(b))?(a):(b))
 
+struct fm_rds_data_t fm_rds_data;
+struct dab_service_list_t dab_service_list;
+
 uint8_t dab_num_channels;
 int wait = 0;
+/* boot only what audio needs, see si46xx_set_fast_boot() */
+static int fast_boot;
+/* last reply poll has seen CTS, no need to check busy before next command */
+static int cts_ready = 0;
+
+/*
+ * Expected time to CTS and to STCINT and CTS time budget per command,
+ * us. CTS is not polled before it is expected, and waiting gives up once
+ * the budget is used. sub matches the first argument byte, -1 any.
+ */
+static const struct si46xx_cmd_time {
+	uint8_t cmd;
+	int sub;
+	int cts;
+	int budget;
+	int stc;
+} si46xx_cmd_times[] = {
+	{ SI46XX_POWER_UP,	-1,	20,	100 * 1000,	0 },
+	{ SI46XX_HOST_LOAD,	-1,	0,	100 * 1000,	0 },
+	{ SI46XX_LOAD_INIT,	-1,	4000,	100 * 1000,	0 },
+	{ SI46XX_BOOT,		-1,	60000,	2000 * 1000,	0 },
+	/* load image, erase chip, erase sector, write block */
+	{ SI46XX_FLASH_LOAD,	0x00,	50000,	2000 * 1000,	0 },
+	{ SI46XX_FLASH_LOAD,	0xFF,	500000,	60000 * 1000,	0 },
+	{ SI46XX_FLASH_LOAD,	0xFE,	20000,	1000 * 1000,	0 },
+	{ SI46XX_FLASH_LOAD,	0xF0,	500,	500 * 1000,	0 },
+	{ SI46XX_FLASH_LOAD,	0xF1,	500,	500 * 1000,	0 },
+	{ SI46XX_FM_TUNE_FREQ,	-1,	0,	200 * 1000,	10000 },
+	{ SI46XX_FM_SEEK_START,	-1,	0,	200 * 1000,	10000 },
+	{ SI46XX_AM_TUNE_FREQ,	-1,	0,	200 * 1000,	10000 },
+	{ SI46XX_AM_SEEK_START,	-1,	0,	200 * 1000,	10000 },
+	{ SI46XX_DAB_TUNE_FREQ,	-1,	0,	200 * 1000,	50000 },
+};
+
+/*
+ * BOOT per image, sub is the mode booted. Images of unknown mode use the
+ * BOOT entry above.
+ */
+static const struct si46xx_cmd_time si46xx_boot_times[] = {
+	{ SI46XX_BOOT,		SI46XX_MODE_FM,	60000,	500 * 1000,	0 },
+	{ SI46XX_BOOT,		SI46XX_MODE_AM,	60000,	500 * 1000,	0 },
+	{ SI46XX_BOOT,		SI46XX_MODE_DAB, 190000, 1000 * 1000,	0 },
+};
+
+static const struct si46xx_cmd_time si46xx_cmd_time_default = {
+	0, -1, 0, 200 * 1000, 0
+};
+
+/* timing of last command sent */
+static const struct si46xx_cmd_time *cmd_time = &si46xx_cmd_time_default;
+static uint64_t cmd_sent;
 
-int SPI_Write(char *out, int out_len, char *in, int in_len, int deact)
+/* STATUS0 interrupt bits seen by polls, until taken */
+static uint8_t status_int;
+/* CTS and STC interrupts drive INTB, set up by si46xx_int_enable() */
+static int intb_enabled;
+
+/*
+ * Transfer arena: preallocated frames for the whole command path,
+ * tx holds outgoing command frames, rx is used for RD_REPLY polls.
+ */
+static struct {
+	uint8_t tx[SI46XX_FRAME_SIZE];
+	uint8_t rx[SI46XX_FRAME_SIZE];
+} arena;
+
+/* command arguments can be built in place to avoid a copy */
+#define ARENA_ARGS	(arena.tx + 1)
+#define ARENA_HOST_LOAD	(arena.tx + 4)
+
+/*
+ * SPI transport
+ */
+static int spi_bus_write(const uint8_t *buf, int len)
 {
-	if (spi_fd)
-		return spi_io(out, in, MAX(in_len, out_len), deact);
-	else if (i2c_fd) {
-		/* some shitty workaround */
-		if ((out != NULL) && (out == in))
-			return i2c_io(out, out_len, in + out_len, in_len - 1);
-		return i2c_io(out, out_len, in, in_len);
-	} else {
+	return spi_io((uint8_t *)buf, NULL, len, 1);
+}
+
+/* header and data as two segments of one frame, CS is kept in between */
+static int spi_bus_write_gather(const uint8_t *hdr, int hlen,
+	const uint8_t *data, int len)
+{
+	struct spi_msg msg;
+
+	spi_msg_init(&msg);
+	spi_msg_add(&msg, hdr, NULL, hlen, 0, 0);
+	spi_msg_add(&msg, data, NULL, len, 0, 0);
+	return spi_msg_send(&msg);
+}
+
+/* data[0] is the byte clocked in while sending RD_REPLY */
+static int spi_bus_read_reply(uint8_t *data, int cnt)
+{
+	memset(data, 0, cnt + 1);
+	data[0] = SI46XX_RD_REPLY;
+	return spi_io(data, data, cnt + 1, 1);
+}
+
+/*
+ * Command frame and the first RD_REPLY poll are sent as one SPI message
+ * with CS released in between, so commands that complete within
+ * SI46XX_CTS_GUARD_US cost a single ioctl.
+ */
+static int spi_bus_command(const uint8_t *buf, int len, uint8_t *data, int cnt)
+{
+	struct spi_msg msg;
+
+	memset(data, 0, cnt + 1);
+	data[0] = SI46XX_RD_REPLY;
+
+	spi_msg_init(&msg);
+	spi_msg_add(&msg, buf, NULL, len, 1, SI46XX_CTS_GUARD_US);
+	spi_msg_add(&msg, data, data, cnt + 1, 0, 0);
+	return spi_msg_send(&msg);
+}
+
+static const struct si46xx_bus spi_bus = {
+	.name		= "spi",
+	.write		= spi_bus_write,
+	.read_reply	= spi_bus_read_reply,
+	.command	= spi_bus_command,
+	.write_gather	= spi_bus_write_gather,
+};
+
+/*
+ * I2C transport
+ */
+static int i2c_bus_write(const uint8_t *buf, int len)
+{
+	return i2c_io((uint8_t *)buf, len, NULL, 0);
+}
+
+static int i2c_bus_read_reply(uint8_t *data, int cnt)
+{
+	static uint8_t rd_reply = SI46XX_RD_REPLY;
+
+	return i2c_io(&rd_reply, 1, data + 1, cnt);
+}
+
+static const struct si46xx_bus i2c_bus = {
+	.name		= "i2c",
+	.write		= i2c_bus_write,
+	.read_reply	= i2c_bus_read_reply,
+};
+
+static const struct si46xx_bus *bus = NULL;
+
+static int si46xx_bus_write(const uint8_t *buf, int len)
+{
+	if (!bus) {
+		printf("No interface to Si provided\n");
+		return -EINVAL;
+	}
+	return bus->write(buf, len);
+}
+
+static int si46xx_bus_read_reply(uint8_t *data, int cnt)
+{
+	if (!bus) {
 		printf("No interface to Si provided\n");
 		return -EINVAL;
 	}
+	return bus->read_reply(data, cnt);
 }
 
 void print_hex_str(uint8_t *str, uint16_t len)
@@ -83,53 +274,169 @@ void print_hex_str(uint8_t *str, uint16_t len)
 	printf("\n");
 }
 
+/*
+ * Note send time and expected timing of command frame
+ */
+static void si46xx_cmd_start(const uint8_t *frame, int len)
+{
+	unsigned int i;
+
+	cmd_time = &si46xx_cmd_time_default;
+	for (i = 0; i < ARRAY_SIZE(si46xx_cmd_times); i++) {
+		if ((si46xx_cmd_times[i].cmd == frame[0]) &&
+		    ((si46xx_cmd_times[i].sub < 0) ||
+		     ((len > 1) && (si46xx_cmd_times[i].sub == frame[1])))) {
+			cmd_time = &si46xx_cmd_times[i];
+			break;
+		}
+	}
+	/* STCINT seen so far belongs to previous tune */
+	if (cmd_time->stc)
+		status_int &= ~SI46XX_STATUS_STCINT;
+	/* reset and new firmware start with interrupts disabled */
+	if ((frame[0] == SI46XX_POWER_UP) || (frame[0] == SI46XX_BOOT))
+		intb_enabled = 0;
+	/* edges queued so far belong to previous commands */
+	if (intb_enabled)
+		gpio_intb_wait(0);
+	cmd_sent = wait_now();
+}
+
+/*
+ * HOST_LOAD data bytes per frame. A frame has to fit one spidev transfer,
+ * CS is not reliably held across two.
+ */
+static int si46xx_host_load_chunk(void)
+{
+	int chunk = FW_LOAD_BUF;
+
+	if ((bus == &spi_bus) && (spi_get_bufsiz() - 4 < chunk))
+		chunk = (spi_get_bufsiz() - 4) & ~3;
+	return chunk;
+}
+
 static int si46xx_write_host_load_data(uint8_t cmd,
 		const uint8_t *ptr,
 		uint16_t len)
 {
+	uint8_t *data = arena.tx;
 	int ret;
-	uint8_t *data = malloc(len + 4);
 
+	if (len > FW_LOAD_BUF)
+		return -EINVAL;
+
+	prof_begin(PROF_HOST_LOAD);
 	data[0] = cmd;
 	data[1] = 0;
 	data[2] = 0;
 	data[3] = 0;
-	memcpy(data + 4, ptr, len);
-	ret = SPI_Write(data, len + 4, NULL, 0, 1);
-	free(data);
+	cts_ready = 0;
+	si46xx_cmd_start(data, len + 4);
+	/* data is sent from where it is, if transport can gather */
+	if ((ptr != ARENA_HOST_LOAD) && (bus) && (bus->write_gather)) {
+		ret = bus->write_gather(data, 4, ptr, len);
+	} else {
+		if (ptr != ARENA_HOST_LOAD)
+			memcpy(data + 4, ptr, len);
+		ret = si46xx_bus_write(data, len + 4);
+	}
+	prof_end(PROF_HOST_LOAD);
 	return ret;
 }
 
+/*
+ * Wait for INTB until limit. Without INTB, or while INTB is held by an
+ * interrupt already pending so no edge can come, sleep until next.
+ */
+static void si46xx_wait_int(uint64_t next, uint64_t limit)
+{
+	uint64_t now = wait_now();
+
+	if ((intb_enabled) && (limit > now) && (gpio_intb_asserted() == 0) &&
+	    (gpio_intb_wait(limit - now) >= 0))
+		return;
+	wait_until(next);
+}
+
+/*
+ * Check RD_REPLY frame (data[0] is the dummy byte clocked in while sending
+ * RD_REPLY), copy reply on CTS or error, return -EAGAIN while busy
+ */
+static int si46xx_reply_status(const uint8_t *data, uint8_t *ptr, uint8_t cnt)
+{
+	status_int |= data[1] & SI46XX_STATUS_INT_MASK;
+	if (data[1] & 0x80) {
+		cts_ready = 1;
+		if (ptr)
+			memcpy(ptr, data + 1, cnt);
+		return 0;
+	}
+	if (data[1] & 0x40) {
+		if (ptr)
+			memcpy(ptr, data + 1, cnt);
+		return -EIO;
+	}
+	return -EAGAIN;
+}
+
+/*
+ * Return interrupt bits of mask seen in status since last taken, and
+ * clear them
+ */
+uint8_t si46xx_status_take(uint8_t mask)
+{
+	uint8_t bits = status_int & mask;
+
+	status_int &= ~bits;
+	return bits;
+}
+
+/*
+ * Poll for CTS of last command, not before it is expected and until its
+ * time budget is used, backing off between polls
+ */
 static int si46xx_read(uint8_t *ptr, uint8_t cnt)
 {
 	int ret;
-	int timeout;
-	uint8_t *data = malloc(cnt + 1);
-
-	timeout = 1000; // wait for CTS
-	usleep(20);
-	while(--timeout) {
-		//msleep(1); // make sure cs is high for 20us
-		data[0] = SI46XX_RD_REPLY;
-		ret = SPI_Write(data, 1, data, cnt + 1, 1); // read status register (we are working without interrupts)
+	uint8_t *data = arena.rx;
+	/* only status is polled, full reply is read once on CTS */
+	uint8_t poll_cnt = MIN(cnt, 4);
+	uint64_t deadline = cmd_sent + cmd_time->budget;
+	uint64_t limit;
+	uint64_t next;
+	uint64_t now;
+	int interval = SI46XX_POLL_MIN_US;
+
+	cts_ready = 0;
+	now = wait_now();
+	next = MAX(cmd_sent + cmd_time->cts, now + SI46XX_POLL_MIN_US);
+	/* first poll when CTS is expected, INTB may bring it earlier */
+	limit = next;
+	for (;;) {
+		si46xx_wait_int(next, limit); // CTSINT
+		/* make sure cs is high for 20us */
+		wait_until(now + SI46XX_POLL_MIN_US);
+		ret = si46xx_bus_read_reply(data, poll_cnt); // read status register
 		if (ret < 0)
 			return ret;
-		if (data[1] & 0x80) {
-			if (ptr)
-				memcpy(ptr, data + 1, cnt);
-			free(data);
-			return 0;
-		}
-		if (data[1] & 0x40) {
-			if (ptr)
-				memcpy(ptr, data + 1, cnt);
-			free(data);
-			return -EIO;
+		if ((poll_cnt != cnt) && (data[1] & 0xC0)) {
+			ret = si46xx_bus_read_reply(data, cnt);
+			if (ret < 0)
+				return ret;
 		}
-		usleep(20); // make sure cs is high for 20us
+		ret = si46xx_reply_status(data, ptr, cnt);
+		if (ret != -EAGAIN)
+			return ret;
+		now = wait_now();
+		if (now >= deadline)
+			break;
+		interval = MIN(interval * 2, SI46XX_POLL_MAX_US);
+		next = MIN(now + interval, deadline);
+		/* still busy, INTB comes on CTS */
+		limit = deadline;
 	}
-	free(data);
 	printf("Timeout waiting for CTS\n");
+	trace_dump(TRACE_ERR_RECORDS);
 	return -ETIME;
 }
 
@@ -144,12 +451,18 @@ static int si46xx_write_data(uint8_t cmd,
 {
 	int ret;
 	uint8_t timeout;
-	uint8_t *data;
+	uint8_t *data = arena.tx;
 
-	/* check busy */
-	ret = si46xx_read(NULL, 4);
-	if (ret)
-		return ret;
+	if (len + 1 > SI46XX_FRAME_SIZE)
+		return -EINVAL;
+
+	/* check busy, unless previous reply already had CTS */
+	if (!cts_ready) {
+		ret = si46xx_read(NULL, 4);
+		if (ret)
+			return ret;
+	}
+	cts_ready = 0;
 /*
 	timeout = 100; // wait for CTS
 	while(--timeout){
@@ -163,54 +476,84 @@ static int si46xx_write_data(uint8_t cmd,
 		return -ETIME;
 	}
 */
-	data = malloc(len + 1);
 	data[0] = cmd;
-	if (data && len)
+	if (len && ptr != ARENA_ARGS)
 		memcpy(data + 1, ptr, len);
-	ret = SPI_Write(data, len + 1, NULL, 0, 1);
-	free(data);
-	return ret;
+	si46xx_cmd_start(data, len + 1);
+	return si46xx_bus_write(data, len + 1);
 }
 
-static uint16_t si46xx_read_dynamic__(uint8_t *data)
+/*
+ * Send command and read its reply.
+ * Transports that can do it send the command frame and the first
+ * RD_REPLY poll in one transaction. The CTS loop is only entered if the
+ * chip is still busy at the first poll.
+ * The busy check can not be part of the same transaction: the command
+ * would already be clocked in before its result is known. It is skipped
+ * when the previous reply has seen CTS.
+ */
+static int si46xx_command(uint8_t cmd, const uint8_t *ptr, uint16_t len,
+		uint8_t *reply, uint8_t cnt)
 {
 	int ret;
-	uint8_t zero = 0;
-	uint16_t cnt;
+	uint8_t *data = arena.tx;
+	uint8_t *poll = arena.rx;
 
-	CS_HIGH();
-	msleep(1); // make sure cs is high for 20us
-	CS_LOW();
-	ret = SPI_Write(&zero, 1, NULL, 0, 0);
-	if (ret < 0)
-		goto exit;
-	ret = SPI_Write(NULL, 0, data, 6, 0);
-	if (ret < 0)
-		goto exit;
-	cnt = ((uint16_t)data[5] << 8) | (uint16_t)data[4];
-	if(cnt > 3000)
-		cnt = 0;
-	ret = SPI_Write(NULL, 0, &data[6], cnt, 1);
-exit:
-	CS_HIGH();
-	msleep(1); // make sure cs is high for 20us
-	if (ret < 0)
-		return ret;
-	return cnt + 6;
+	if (len + 1 > SI46XX_FRAME_SIZE)
+		return -EINVAL;
+
+	if ((!bus) || (!bus->command)) {
+		ret = si46xx_write_data(cmd, (uint8_t *)ptr, len);
+		if (ret)
+			return ret;
+		return si46xx_read(reply, cnt);
+	}
+
+	/* check busy */
+	if (!cts_ready) {
+		ret = si46xx_read(NULL, 4);
+		if (ret)
+			return ret;
+	}
+	cts_ready = 0;
+
+	data[0] = cmd;
+	if (len && ptr != ARENA_ARGS)
+		memcpy(data + 1, ptr, len);
+
+	si46xx_cmd_start(data, len + 1);
+	ret = bus->command(data, len + 1, poll, cnt);
+	if (ret == 0)
+		ret = si46xx_reply_status(poll, reply, cnt);
+
+	/* still busy, fall back to polling */
+	if (ret == -EAGAIN)
+		ret = si46xx_read(reply, cnt);
+
+	return ret;
 }
 
-static uint16_t si46xx_read_dynamic(uint8_t *data)
+/*
+ * Reply can be read again, so read header for the length first and
+ * then the whole reply
+ */
+static uint16_t si46xx_read_dynamic(uint8_t *data, uint16_t size)
 {
-	uint8_t zero = 0;
+	uint8_t *reply = arena.rx;
 	uint16_t cnt;
 
-	SPI_Write(&zero, 1, NULL, 0, 0);
-	SPI_Write(NULL, 0, data, 6, 0);
-	cnt = ((uint16_t)data[5] << 8) | (uint16_t)data[4];
+	/* the length field is only valid once CTS is set */
+	if (si46xx_read(NULL, 4))
+		return 0;
+	if (si46xx_bus_read_reply(reply, 6) < 0)
+		return 0;
+	cnt = ((uint16_t)reply[6] << 8) | (uint16_t)reply[5];
 	printf("cnt = %d\n", cnt);
-	if (cnt > 3000)
+	if (cnt + 6 > size)
 		cnt = 0;
-	SPI_Write(NULL, 0, &data[6], cnt, 1);
+	if (si46xx_bus_read_reply(reply, cnt + 6) < 0)
+		return 0;
+	memcpy(data, reply + 1, cnt + 6);
 
 	return cnt + 6;
 }
@@ -232,7 +575,8 @@ int si46xx_check_reply(char *buf)
 	if (buf[0] & (1 << 6)) {
 		printf("ERR_CMD\n");
 		print_hex_str(buf, 4);
-		printf("PUP_STATE: %s\n", pup_states_names[buf[3] >> 6]);
+		trace_dump(TRACE_ERR_RECORDS);
+		printf("PUP_STATE: %s\n", pup_states_names[(uint8_t)buf[3] >> 6]);
 		if (buf[3] & (1 << 3)) {
 			printf("REPOFERR (reply too fast)\n");
 			ret = -EBUSY;
@@ -265,6 +609,19 @@ int si46xx_read_reply(char *buf, int len)
 	return si46xx_check_reply(buf);
 }
 
+static int si46xx_command_reply(uint8_t cmd, const uint8_t *ptr,
+		uint16_t len, char *buf, int cnt)
+{
+	int ret;
+
+	ret = si46xx_command(cmd, ptr, len, buf, cnt);
+	if (ret)
+		return ret;
+
+	/* check basic errors */
+	return si46xx_check_reply(buf);
+}
+
 int si46xx_get_sys_state(void)
 {
 	int ret;
@@ -272,8 +629,8 @@ int si46xx_get_sys_state(void)
 	char buf[6];
 	uint8_t mode;
 
-	si46xx_write_data(SI46XX_GET_SYS_STATE, &zero, 1);
-	ret = si46xx_read_reply(buf, sizeof(buf));
+	ret = si46xx_command_reply(SI46XX_GET_SYS_STATE, &zero, 1,
+		buf, sizeof(buf));
 	if (ret)
 		return ret;
 	mode = buf[4];
@@ -299,11 +656,12 @@ int si46xx_get_sys_mode(void)
 	char buf[6];
 	uint8_t mode;
 
-	si46xx_write_data(SI46XX_GET_SYS_STATE, &zero, 1);
-	ret = si46xx_read_reply(buf, sizeof(buf));
+	ret = si46xx_command_reply(SI46XX_GET_SYS_STATE, &zero, 1,
+		buf, sizeof(buf));
 	if (ret)
 		return ret;
 	mode = buf[4];
+	spi_set_phase(mode ? SPI_PHASE_APP : SPI_PHASE_BOOT);
 	switch(mode)
 	{
 		case 0:
@@ -322,14 +680,102 @@ int si46xx_get_sys_mode(void)
 	}
 }
 
+static int si46xx_get_func_info(uint8_t *rev)
+{
+	int ret;
+	uint8_t zero = 0;
+	char buf[4 + FW_INFO_REV_LEN];
+
+	ret = si46xx_command_reply(SI46XX_GET_FUNC_INFO, &zero, 1,
+		buf, sizeof(buf));
+	if (ret)
+		return ret;
+	memcpy(rev, buf + 4, FW_INFO_REV_LEN);
+	return 0;
+}
+
+/* running image is the one last booted from manifest entry */
+static int si46xx_image_running(const struct fw_info *info)
+{
+	uint8_t rev[FW_INFO_REV_LEN];
+
+	/* nothing to compare with */
+	if ((info == NULL) || (!info->rev_valid))
+		return 0;
+	if (si46xx_get_func_info(rev))
+		return 0;
+	return fw_info_match(info, rev);
+}
+
+/* remember revision of image just started */
+static void si46xx_image_booted(struct fw_info *info)
+{
+	uint8_t rev[FW_INFO_REV_LEN];
+
+	if ((info == NULL) || (si46xx_get_func_info(rev)))
+		return;
+	printf("%s revision %d.%d.%d\n", info->name, rev[0], rev[1], rev[2]);
+	fw_info_set_rev(info, rev);
+	fw_manifest_save(FW_MANIFEST_PATH);
+}
+
+/* images in flash are known by offset, writes drop those overlapped */
+static void si46xx_flash_changed(int offset, int size)
+{
+	fw_info_forget_flash(offset, size);
+	fw_manifest_save(FW_MANIFEST_PATH);
+}
+
+/*
+ * Flash at offset holds something unknown, e.g. after a failed write
+ */
+void si46xx_flash_forget(int offset, int size)
+{
+	si46xx_flash_changed(offset, size);
+}
+
+/*
+ * Image of size bytes was written to flash at offset, flash boot can
+ * tell it from the image file now and the next write of that offset
+ * can skip unchanged blocks
+ */
+void si46xx_flash_written(int offset, const void *buf, int size)
+{
+	static struct fw_blocks blocks;
+	char name[FW_INFO_NAME_LEN];
+
+	snprintf(name, sizeof(name), FW_INFO_FLASH, offset);
+	fw_info_data(name, buf, size);
+	fw_manifest_save(FW_MANIFEST_PATH);
+	if (fw_blocks_calc(&blocks, buf, size, FLASH_DELTA_BLOCK_SIZE) == 0)
+		fw_blocks_save(name, &blocks);
+}
+
+/*
+ * Blocks last written to flash at offset, -ENOENT if unknown or the
+ * flash was changed there since
+ */
+int si46xx_flash_blocks(int offset, struct fw_blocks *blocks)
+{
+	char name[FW_INFO_NAME_LEN];
+	struct fw_info *info;
+
+	snprintf(name, sizeof(name), FW_INFO_FLASH, offset);
+	info = fw_info_find(name);
+	if ((info == NULL) || (fw_blocks_load(name, blocks)) ||
+	    (info->size != blocks->size) || (info->crc != blocks->crc))
+		return -ENOENT;
+	return 0;
+}
+
 static int si46xx_get_part_info()
 {
 	int ret;
 	uint8_t zero = 0;
 	char buf[22];
 
-	si46xx_write_data(SI46XX_GET_PART_INFO,&zero,1);
-	ret = si46xx_read_reply(buf, sizeof(buf));
+	ret = si46xx_command_reply(SI46XX_GET_PART_INFO, &zero, 1,
+		buf, sizeof(buf));
 	if(ret)
 		return ret;
 
@@ -364,8 +810,8 @@ int si46xx_dab_start_digital_service(uint32_t service_id,
 	data[9] = (comp_id >> 16) & 0xFF;
 	data[10] = (comp_id >> 24) & 0xFF;
 
-	si46xx_write_data(SI46XX_DAB_START_DIGITAL_SERVICE,data,11);
-	return si46xx_read(NULL, 4);
+	return si46xx_command(SI46XX_DAB_START_DIGITAL_SERVICE, data, 11,
+		NULL, 4);
 }
 
 static void si46xx_swap_services(uint8_t first, uint8_t second)
@@ -447,19 +893,14 @@ void si46xx_dab_get_ensemble_info()
 {
 	char buf[22];
 	char data;
-	uint8_t timeout;
 	char label[17];
 
 	//data[0] = (1<<4) | (1<<0); // force_wb, low side injection
 	data = 0;
 
-	si46xx_write_data(SI46XX_DAB_GET_ENSEMBLE_INFO, &data, 1);
-	timeout = 10;
-	while(--timeout){ // completed with CTS
-		si46xx_read(buf, 22);
-		if(buf[0] & 0x80)
-			break;
-	}
+	// completed with CTS
+	if (si46xx_command(SI46XX_DAB_GET_ENSEMBLE_INFO, &data, 1, buf, 22))
+		return;
 	memcpy(label, &buf[6], 16);
 	label[16] = '\0';
 	printf("Name: %s",label);
@@ -501,15 +942,19 @@ int si46xx_dab_get_digital_service_list()
 {
 	uint8_t zero = 0;
 	uint16_t len;
-	uint16_t timeout;
+	uint64_t deadline;
 	char buf[2047+6];
 
 	printf("si46xx_dab_get_digital_service_list()\n");
-	timeout = 100;
-	while(timeout--){
+	deadline = wait_now() + SI46XX_SERVICE_LIST_BUDGET_US;
+	for (;;) {
 		si46xx_write_data(SI46XX_DAB_GET_DIGITAL_SERVICE_LIST,&zero,1);
-		if((len = si46xx_read_dynamic(buf)) > 6)
+		if((len = si46xx_read_dynamic(buf, sizeof(buf))) > 6)
 			break;
+		// list not acquired yet
+		if (wait_now() + SI46XX_SERVICE_LIST_RETRY_US > deadline)
+			break;
+		wait_us(SI46XX_SERVICE_LIST_RETRY_US);
 	}
 	si46xx_dab_parse_service_list(buf,len);
 	return len;
@@ -522,12 +967,12 @@ int si46xx_dab_get_audio_info(void)
 	char buf[9];
 
 	printf("si46xx_dab_get_audio_info()\n");
-	si46xx_write_data(SI46XX_DAB_GET_AUDIO_INFO, &zero, 1);
-	ret = si46xx_read(buf, sizeof(buf));
+	ret = si46xx_command(SI46XX_DAB_GET_AUDIO_INFO, &zero, 1,
+		buf, sizeof(buf));
 	if (ret)
 		return ret;
-	printf("Bit rate: %dkbps\n",buf[4] + (buf[5]<<8));
-	printf("Sample rate: %dHz\n",buf[6] + (buf[7]<<8));
+	printf("Bit rate: %dkbps\n",(uint8_t)buf[4] + ((uint8_t)buf[5]<<8));
+	printf("Sample rate: %dHz\n",(uint8_t)buf[6] + ((uint8_t)buf[7]<<8));
 	if((buf[8]& 0x03) == 0) {
 		printf("Audio Mode = Dual Mono\n");
 	}
@@ -551,8 +996,8 @@ void si46xx_dab_get_subchannel_info(void)
 	uint8_t zero = 0;
 	char buf[12];
 	printf("si46xx_dab_get_subchannel_info()\n");
-	si46xx_write_data(SI46XX_DAB_GET_SUBCHAN_INFO, &zero, 1);
-	si46xx_read(buf, sizeof(buf));
+	si46xx_command(SI46XX_DAB_GET_SUBCHAN_INFO, &zero, 1,
+		buf, sizeof(buf));
 	if(buf[4] == 0) {
 		printf("Service Mode = Audio Stream Service\n");
 	}
@@ -648,26 +1093,77 @@ int si46xx_dab_set_freq_list(uint8_t num, uint32_t *freq_list)
 		data[5+4*i] = freq_list[i] >> 16;
 		data[6+4*i] = freq_list[i] >> 24;
 	}
-	si46xx_write_data(SI46XX_DAB_SET_FREQ_LIST, data, 3 + 4 * num);
+	return si46xx_command(SI46XX_DAB_SET_FREQ_LIST, data, 3 + 4 * num,
+		NULL, 4);
+}
 
-	return si46xx_read(NULL, 4);
+/*
+ * Acknowledge STCINT of tune/seek cmd, else it keeps INTB asserted and
+ * no edge comes for following interrupts
+ */
+static int si46xx_stc_ack(uint8_t cmd)
+{
+	uint8_t data = 0x01; // STC_ACK
+	uint8_t ack;
+	char buf[4];
+	int ret;
+
+	if (!intb_enabled)
+		return 0;
+
+	switch (cmd) {
+	case SI46XX_FM_TUNE_FREQ:
+	case SI46XX_FM_SEEK_START:
+		ack = SI46XX_FM_RSQ_STATUS;
+		break;
+	case SI46XX_AM_TUNE_FREQ:
+	case SI46XX_AM_SEEK_START:
+		ack = SI46XX_AM_RSQ_STATUS;
+		break;
+	case SI46XX_DAB_TUNE_FREQ:
+		ack = SI46XX_DAB_DIGRAD_STATUS;
+		break;
+	default:
+		return 0;
+	}
+	ret = si46xx_command(ack, &data, 1, buf, sizeof(buf));
+	si46xx_status_take(SI46XX_STATUS_STCINT);
+	return ret;
 }
 
-int si46xx_tune_wait(int timeout)
+/*
+ * Wait for STCINT of last tune/seek until deadline
+ */
+static int si46xx_stc_wait(uint64_t deadline)
 {
 	int ret;
 	char buf[5];
-
-	do {
+	uint8_t cmd = cmd_time->cmd;
+	uint64_t expect;
+	uint64_t now;
+
+	/* STCINT is not polled before it is expected */
+	expect = MIN(cmd_sent + cmd_time->stc, deadline);
+	si46xx_wait_int(expect, deadline);
+	for (;;) {
 		ret = si46xx_read(buf, sizeof(buf));
 		if (ret)
 			return ret;
-		if (buf[0] & (1 << 0))
-			return 0;
-		msleep(1);
-	} while (--timeout > 0);
+		if (si46xx_status_take(SI46XX_STATUS_STCINT)) {
+			prof_end(PROF_TUNE);
+			return si46xx_stc_ack(cmd);
+		}
+		now = wait_now();
+		if (now >= deadline)
+			return -ETIME;
+		si46xx_wait_int(MIN(now + SI46XX_STC_POLL_US, deadline),
+			deadline); // STCINT
+	}
+}
 
-	return -ETIME;
+int si46xx_tune_wait(int timeout)
+{
+	return si46xx_stc_wait(wait_now() + (uint64_t)timeout * 1000);
 }
 
 int si46xx_dab_tune_freq(uint8_t index, uint8_t antcap)
@@ -675,7 +1171,6 @@ int si46xx_dab_tune_freq(uint8_t index, uint8_t antcap)
 	int ret;
 	uint8_t data[5];
 	char buf[4];
-	uint8_t timeout;
 
 	printf("si46xx_dab_tune_freq(%d): ",index);
 
@@ -686,17 +1181,15 @@ int si46xx_dab_tune_freq(uint8_t index, uint8_t antcap)
 	data[3] = antcap;
 	data[4] = 0;
 
-	si46xx_write_data(SI46XX_DAB_TUNE_FREQ, data, sizeof(data));
-	timeout = 20;
-	while(--timeout){ // wait for tune to complete
-		ret = si46xx_read(buf, sizeof(buf));
-		if (ret)
-			return ret;
-		if(buf[0] & 0x01)
-			break;
-		msleep(100);
-	}
-	return ret;
+	prof_begin(PROF_TUNE);
+	ret = si46xx_command(SI46XX_DAB_TUNE_FREQ, data, sizeof(data),
+		buf, sizeof(buf));
+	if (ret)
+		return ret;
+	if (buf[0] & 0x01)
+		return 0;
+	// wait for tune to complete
+	return si46xx_stc_wait(cmd_sent + SI46XX_DAB_TUNE_BUDGET_US);
 }
 
 int si46xx_fm_tune_freq(uint32_t khz, uint16_t antcap)
@@ -712,9 +1205,9 @@ int si46xx_fm_tune_freq(uint32_t khz, uint16_t antcap)
 	data[2] = ((khz/10) >> 8) & 0xFF;
 	data[3] = antcap & 0xFF;
 	data[4] = 0;
-	si46xx_write_data(SI46XX_FM_TUNE_FREQ, data, sizeof(data));
-
-	return si46xx_read(NULL, 4);
+	prof_begin(PROF_TUNE);
+	return si46xx_command(SI46XX_FM_TUNE_FREQ, data, sizeof(data),
+		NULL, 4);
 }
 
 int si46xx_am_tune_freq(uint32_t khz, uint16_t antcap)
@@ -730,9 +1223,9 @@ int si46xx_am_tune_freq(uint32_t khz, uint16_t antcap)
 	data[2] = (khz >> 8) & 0xFF;
 	data[3] = antcap & 0xFF;
 	data[4] = (antcap >> 8) & 0xFF;
-	si46xx_write_data(SI46XX_AM_TUNE_FREQ, data, sizeof(data));
-
-	return si46xx_read(NULL, 4);
+	prof_begin(PROF_TUNE);
+	return si46xx_command(SI46XX_AM_TUNE_FREQ, data, sizeof(data),
+		NULL, 4);
 }
 
 int si46xx_tune_freq(int mode, uint32_t khz, uint16_t antcap)
@@ -760,9 +1253,7 @@ int si46xx_fm_seek_start(uint8_t up, uint8_t wrap)
 	data[2] = 0;
 	data[3] = 0;
 	data[4] = 0;
-	si46xx_write_data(SI46XX_FM_SEEK_START, data, 5);
-
-	return si46xx_read(NULL, 4);
+	return si46xx_command(SI46XX_FM_SEEK_START, data, 5, NULL, 4);
 }
 
 int si46xx_seek_start(int mode, uint8_t up, uint8_t wrap)
@@ -777,112 +1268,190 @@ int si46xx_seek_start(int mode, uint8_t up, uint8_t wrap)
 	data[3] = 0;
 	data[4] = 0;
 	if (mode == SI46XX_MODE_AM)
-		si46xx_write_data(SI46XX_AM_SEEK_START, data, 5);
+		return si46xx_command(SI46XX_AM_SEEK_START, data, 5, NULL, 4);
 	else if (mode == SI46XX_MODE_FM)
-		si46xx_write_data(SI46XX_FM_SEEK_START, data, 5);
+		return si46xx_command(SI46XX_FM_SEEK_START, data, 5, NULL, 4);
 	else
 		return -EINVAL;
-
-	return si46xx_read(NULL, 4);
 }
 
 static int si46xx_load_init()
 {
 	uint8_t data = 0;
 	char buf[4];
+	int ret;
 
 	printf("si46xx_load_init()\n");
 
-	si46xx_write_data(SI46XX_LOAD_INIT, &data, 1);
-	msleep(4); // wait 4ms (datasheet)
-	return si46xx_read_reply(buf, sizeof(buf));
+	prof_begin(PROF_LOAD_INIT);
+	ret = si46xx_write_data(SI46XX_LOAD_INIT, &data, 1);
+	if (ret == 0)
+		ret = si46xx_read_reply(buf, sizeof(buf));
+	prof_end(PROF_LOAD_INIT);
+	return ret;
 }
 
-static int store_image(const uint8_t *data, uint32_t len, uint8_t wait_for_int)
+static int host_load_begin(void)
 {
 	int ret;
-	uint32_t remaining_bytes = len;
-	uint32_t count_to;
 
 	ret = si46xx_load_init();
 	if (ret) {
 		printf("LOAD_INIT failed: %d\n", ret);
 		return ret;
 	}
-	while(remaining_bytes){
-		if(remaining_bytes >= 2048){
-			count_to = 2048;
-		}else{
-			count_to = remaining_bytes;
-		}
+	spi_set_phase(SPI_PHASE_LOAD);
+	return 0;
+}
 
-		si46xx_write_host_load_data(SI46XX_HOST_LOAD,
-			data + (len - remaining_bytes), count_to);
-		remaining_bytes -= count_to;
-		msleep(1);
+static int host_load_end(int ret)
+{
+	char buf[4];
+
+	spi_set_phase(SPI_PHASE_BOOT);
+	if (ret) {
+		printf("HOST_LOAD failed: %d\n", ret);
+		return ret;
 	}
-	msleep(4); // wait 4ms (datasheet)
-	ret = si46xx_read(NULL, 4);
-	msleep(4); // wait 4ms (datasheet)
+	ret = si46xx_read_reply(buf, sizeof(buf));
+	if (ret)
+		printf("Load firmware failed\n");
 	return ret;
 }
 
-//#define FW_LOAD_BUF	256
-#define FW_LOAD_BUF	4096
-static int store_image_from_file(char *filename, uint8_t wait_for_int)
+static int store_image(const uint8_t *data, uint32_t len, uint8_t wait_for_int)
 {
-	int ret = 0;
-	long remaining_bytes;
-	long len;
+	int ret;
+	uint32_t remaining_bytes = len;
 	uint32_t count_to;
-	FILE *fp;
-	uint8_t buffer[FW_LOAD_BUF];
-	size_t result;
-	char buf[4];
+	uint32_t chunk = si46xx_host_load_chunk();
 
-	fp = fopen(filename, "rb");
-	if(fp == NULL){
-		printf("file error %s: %d\n", filename, errno);
-		return -errno;
+	ret = host_load_begin();
+	if (ret)
+		return ret;
+	while(remaining_bytes){
+		if(remaining_bytes >= chunk){
+			count_to = chunk;
+		}else{
+			count_to = remaining_bytes;
+		}
+
+		ret = si46xx_write_host_load_data(SI46XX_HOST_LOAD,
+			data + (len - remaining_bytes), count_to);
+		if (ret)
+			break;
+		remaining_bytes -= count_to;
 	}
+	return host_load_end(ret);
+}
 
-	fseek(fp,0, SEEK_END);
-	len = ftell(fp);
-	remaining_bytes = len;
-	rewind(fp);
+/*
+ * Image not in page cache or compressed: chunks are read (and unpacked)
+ * by pipeline thread while previous ones are sent, reading starts
+ * already before LOAD_INIT
+ */
+static int store_image_pipe(struct fw_pipe *fwp)
+{
+	const uint8_t *chunk;
+	int len;
+	int ret;
 
-	ret = si46xx_load_init();
-	if (ret) {
-		printf("LOAD_INIT failed\n");
-		goto fail;
+	ret = host_load_begin();
+	if (ret == 0) {
+		while ((len = fw_pipe_get(fwp, &chunk)) > 0) {
+			ret = si46xx_write_host_load_data(SI46XX_HOST_LOAD,
+				chunk, len);
+			fw_pipe_put(fwp);
+			if (ret)
+				break;
+		}
+		if (len < 0)
+			ret = len;
+		ret = host_load_end(ret);
 	}
+	fw_pipe_stop(fwp);
 
-	printf("Loading: %s (%d bytes)\n", filename, len);
+	return ret;
+}
 
-	while (remaining_bytes) {
-		if (remaining_bytes >= FW_LOAD_BUF)
-			count_to = FW_LOAD_BUF;
+/*
+ * Image in page cache is mapped and sent straight from there, read
+ * ahead of the whole file is started before LOAD_INIT. Cold images go
+ * through the read pipeline, as do compressed containers (si_lz), which
+ * are also taken when only <filename>.lz exists.
+ */
+static int store_image_from_file(char *filename, uint8_t wait_for_int)
+{
+	int ret;
+	int fd;
+	int resident;
+	int lz;
+	struct stat st;
+	struct fwlz_header hdr;
+	struct fw_pipe fwp;
+	char lz_name[256];
+	void *image;
+
+	fd = open(filename, O_RDONLY);
+	if ((fd < 0) && (errno == ENOENT)) {
+		snprintf(lz_name, sizeof(lz_name), "%s%s", filename,
+			FWLZ_SUFFIX);
+		fd = open(lz_name, O_RDONLY);
+		if (fd >= 0)
+			filename = lz_name;
 		else
-			count_to = remaining_bytes;
+			errno = ENOENT;
+	}
+	if (fd < 0) {
+		printf("file error %s: %d\n", filename, errno);
+		return -errno;
+	}
+	if (fstat(fd, &st) < 0) {
+		ret = -errno;
+		printf("file error %s: %d\n", filename, errno);
+		close(fd);
+		return ret;
+	}
+	if (st.st_size == 0) {
+		printf("file error %s: empty\n", filename);
+		close(fd);
+		return -EINVAL;
+	}
 
-		result = fread(buffer, 1, count_to, fp);
-		if (result != count_to) {
-			printf("file error %s\n", filename);
-			ret = -EIO;
-			goto fail;
+	resident = fw_file_resident(fd, st.st_size);
+	printf("Loading: %s (%ld bytes, %d%% cached)\n", filename,
+		(long)st.st_size, resident);
+	lz = (pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr)) &&
+		(fwlz_header_check(&hdr) == 0);
+	if ((lz) || ((resident >= 0) && (resident < FW_PIPE_COLD_PERCENT))) {
+		if (lz) {
+			printf("Unpacking: %u bytes\n", hdr.size);
+			ret = fw_pipe_start_lz(&fwp, fd, &hdr,
+				si46xx_host_load_chunk());
+		} else {
+			ret = fw_pipe_start(&fwp, fd, st.st_size,
+				si46xx_host_load_chunk());
 		}
+		if (ret == 0)
+			ret = store_image_pipe(&fwp);
+		else
+			printf("Load pipeline start failed: %d\n", ret);
+		close(fd);
+		return ret;
+	}
 
-		si46xx_write_host_load_data(SI46XX_HOST_LOAD, buffer, count_to);
-		remaining_bytes -= count_to;
-		//msleep(1);
+	image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (image == MAP_FAILED) {
+		printf("mmap %s failed: %d\n", filename, errno);
+		return -errno;
 	}
-	msleep(4); // wait 4ms (datasheet)
-	ret = si46xx_read_reply(buf, sizeof(buf));
-	if (ret)
-		printf("Load firmware failed\n");
-	msleep(4); // wait 4ms (datasheet)
-fail:
-	fclose(fp);
+	madvise(image, st.st_size, MADV_SEQUENTIAL);
+	madvise(image, st.st_size, MADV_WILLNEED);
+
+	ret = store_image(image, st.st_size, wait_for_int);
+
+	munmap(image, st.st_size);
 	return ret;
 }
 
@@ -909,27 +1478,58 @@ static int si46xx_powerup(void)
 	data[13] = 0x00; // ARG14
 	data[14] = 0x00; // ARG15
 
+	spi_set_phase(SPI_PHASE_BOOT);
+	prof_begin(PROF_POWERUP);
 	ret = si46xx_write_data(SI46XX_POWER_UP, data, 15);
 	if (ret)
 		return ret;
-	msleep(1); // wait 20us after powerup (datasheet)
-	return si46xx_read_reply(buf, sizeof(buf));
+	/* first poll is 20us after powerup (datasheet), by cmd_times */
+	ret = si46xx_read_reply(buf, sizeof(buf));
+	prof_end(PROF_POWERUP);
+	return ret;
 }
 
-static int si46xx_boot(void)
+/*
+ * Wait for CTS of BOOT just sent, bound by time the image of mode needs
+ * (63ms at analog fm, 198ms at DAB)
+ */
+static int si46xx_boot_wait(int mode)
 {
 	int ret;
-	int i = 5;
-	uint8_t data = 0;
+	unsigned int i;
 	char buf[4];
 
+	for (i = 0; i < ARRAY_SIZE(si46xx_boot_times); i++)
+		if (si46xx_boot_times[i].sub == mode)
+			cmd_time = &si46xx_boot_times[i];
+	ret = si46xx_read_reply(buf, sizeof(buf));
+	prof_end(PROF_BOOT);
+	if (!ret)
+		spi_set_phase(SPI_PHASE_APP);
+	return ret;
+}
+
+static int si46xx_boot(int mode)
+{
+	int ret = 0;
+	int i;
+	uint8_t data = 0;
+
 	printf("si46xx_boot()\n");
 
-	do {
-		si46xx_write_data(SI46XX_BOOT, &data, 1);
-		msleep(300); // 63ms at analog fm, 198ms at DAB
-		ret = si46xx_read_reply(buf, sizeof(buf));
-	} while ((i--) && (ret));
+	for (i = 0; i < SI46XX_BOOT_TRIES; i++) {
+		if (i)
+			printf("BOOT failed: %d, retry %d\n", ret, i);
+		prof_begin(PROF_BOOT);
+		ret = si46xx_write_data(SI46XX_BOOT, &data, 1);
+		if (ret) {
+			prof_end(PROF_BOOT);
+			continue;
+		}
+		ret = si46xx_boot_wait(mode);
+		if (ret == 0)
+			break;
+	}
 	return ret;
 }
 
@@ -943,12 +1543,10 @@ int si46xx_rsq_status(int mode)
 	//printf("si46xx_fm_rsq_status(%d)\n", mode);
 
 	if (mode == SI46XX_MODE_AM) {
-		si46xx_write_data(SI46XX_AM_RSQ_STATUS, &data, 1);
-		ret = si46xx_read(buf, 16);
+		ret = si46xx_command(SI46XX_AM_RSQ_STATUS, &data, 1, buf, 16);
 	}
 	else if (mode == SI46XX_MODE_FM) {
-		si46xx_write_data(SI46XX_FM_RSQ_STATUS, &data, 1);
-		ret = si46xx_read(buf, 20);
+		ret = si46xx_command(SI46XX_FM_RSQ_STATUS, &data, 1, buf, 20);
 	}
 	else
 		return -EINVAL;
@@ -957,7 +1555,7 @@ int si46xx_rsq_status(int mode)
 
 	printf("SNR:        %d dB\n", (signed char) buf[10]);
 	printf("RSSI:       %d dBuV\n", (signed char) buf[9]);
-	khz = (buf[7] << 8) | buf[6];
+	khz = ((uint8_t)buf[7] << 8) | (uint8_t)buf[6];
 	if (mode == SI46XX_MODE_FM)
 		khz *= 10;
 	printf("Frequency:  %dkHz\n", khz);
@@ -979,8 +1577,8 @@ int si46xx_fm_rds_blockcount(void)
 	char buf[10];
 
 	printf("si46xx_rds_blockcount()\n");
-	si46xx_write_data(SI46XX_FM_RDS_BLOCKCOUNT,&data,1);
-	ret = si46xx_read(buf, sizeof(buf));
+	ret = si46xx_command(SI46XX_FM_RDS_BLOCKCOUNT, &data, 1,
+		buf, sizeof(buf));
 	if (ret)
 		return ret;
 	printf("Expected: %d\n",buf[4] | (buf[5]<<8));
@@ -1047,8 +1645,8 @@ int si46xx_fm_rds_status(void)
 	timeout = 5000; // work on 1000 rds blocks max
 	while(--timeout){
 		data = 1;
-		si46xx_write_data(SI46XX_FM_RDS_STATUS, &data, 1);
-		ret = si46xx_read(buf, sizeof(buf));
+		ret = si46xx_command(SI46XX_FM_RDS_STATUS, &data, 1,
+			buf, sizeof(buf));
 		if (ret)
 			return ret;
 		blocks[0] = buf[12] + (buf[13]<<8);
@@ -1089,8 +1687,8 @@ void si46xx_dab_get_service_linking_info(uint32_t service_id)
 	data[4] = (service_id>>8) & 0xFF;
 	data[5] = (service_id>>16) & 0xFF;
 	data[6] = (service_id>>24) & 0xFF;
-	si46xx_write_data(SI46XX_DAB_GET_SERVICE_LINKING_INFO, data, sizeof(data));
-	si46xx_read(buf, 24);
+	si46xx_command(SI46XX_DAB_GET_SERVICE_LINKING_INFO, data, sizeof(data),
+		buf, 24);
 }
 
 void si46xx_dab_digrad_status_print(struct dab_digrad_status_t *status)
@@ -1112,18 +1710,23 @@ void si46xx_dab_digrad_status(struct dab_digrad_status_t *status)
 {
 	uint8_t data = (1<<3) | 1; // set digrad_ack and stc_ack
 	char buf[22];
-	uint8_t timeout = 100;
+	uint64_t deadline;
+	int ret;
 
 	printf("si46xx_dab_digrad_status():\n");
-	timeout = 10;
-	while(--timeout){
+	deadline = wait_now() + SI46XX_DIGRAD_BUDGET_US;
+	for (;;) {
 		data = (1<<3) | 1; // set digrad_ack and stc_ack
-		si46xx_write_data(SI46XX_DAB_DIGRAD_STATUS,&data,1);
-		si46xx_read(buf, sizeof(buf));
-		if(buf[0] & 0x81)
+		ret = si46xx_command(SI46XX_DAB_DIGRAD_STATUS, &data, 1,
+			buf, sizeof(buf));
+		if ((ret == 0) && (buf[0] & 0x81))
 			break;
+		// not ready yet
+		if (wait_now() >= deadline)
+			break;
+		wait_until(MIN(wait_now() + SI46XX_DIGRAD_RETRY_US, deadline));
 	}
-	if(!timeout){
+	if ((ret) || (!(buf[0] & 0x81))) {
 		printf("si46xx_dab_digrad_status() timeout reached\n");
 		return;
 	}
@@ -1172,20 +1775,22 @@ int si46xx_set_property(uint16_t property_id, uint16_t value)
 	char buf[4];
 	char *name;
 
-	/* fix this */
-	name = si46xx_property_name(property_id, SI46XX_MODE_FM);
-	if (name)
-		printf("si46xx_set_property(%s, 0x%02X)\n", name, value);
-	else
-		printf("si46xx_set_property(0x%02X,0x%02X)\n", property_id, value);
-	
+	if (!fast_boot) {
+		/* fix this */
+		name = si46xx_property_name(property_id, SI46XX_MODE_FM);
+		if (name)
+			printf("si46xx_set_property(%s, 0x%02X)\n", name, value);
+		else
+			printf("si46xx_set_property(0x%02X,0x%02X)\n", property_id, value);
+	}
+
 	data[0] = 0;
 	data[1] = property_id & 0xFF;
 	data[2] = (property_id >> 8) & 0xFF;
 	data[3] = value & 0xFF;
 	data[4] = (value >> 8) & 0xFF;
-	si46xx_write_data(SI46XX_SET_PROPERTY, data, 5);
-	return si46xx_read_reply(buf, sizeof(buf));
+	return si46xx_command_reply(SI46XX_SET_PROPERTY, data, 5,
+		buf, sizeof(buf));
 }
 
 /*
@@ -1197,28 +1802,38 @@ int si46xx_flash_erase_chip(void)
 	int i = 0;
 	uint8_t data[3];
 
+	int ret;
+
 	printf("si46xx_flash_erase_chip()\n");
+	fw_info_forget("flash@");
+	fw_manifest_save(FW_MANIFEST_PATH);
 	STORE_U8(0xFF);
 	STORE_U8(0xDE);
 	STORE_U8(0xC0);
 
-	si46xx_write_data(SI46XX_FLASH_LOAD, data, sizeof(data));
-	return si46xx_read(NULL, 4);
+	prof_begin(PROF_FLASH_ERASE);
+	ret = si46xx_command(SI46XX_FLASH_LOAD, data, sizeof(data), NULL, 4);
+	prof_end(PROF_FLASH_ERASE);
+	return ret;
 }
 
 int si46xx_flash_erase_sector(int addr)
 {
 	int i = 0;
+	int ret;
 	uint8_t data[7];
 
-	printf("si46xx_flash_erase_sector()\n");
+	printf("si46xx_flash_erase_sector(0x%08x)\n", addr);
+	si46xx_flash_changed(addr, FLASH_SECTOR_SIZE);
 	STORE_U8(0xFE);
 	STORE_U8(0xDE);
 	STORE_U8(0xC0);
 	STORE_U32(addr);
 
-	si46xx_write_data(SI46XX_FLASH_LOAD, data, sizeof(data));
-	return si46xx_read(NULL, 4);
+	prof_begin(PROF_FLASH_ERASE);
+	ret = si46xx_command(SI46XX_FLASH_LOAD, data, sizeof(data), NULL, 4);
+	prof_end(PROF_FLASH_ERASE);
+	return ret;
 }
 
 int si46xx_flash_property_get(int prop, int *value)
@@ -1232,8 +1847,8 @@ int si46xx_flash_property_get(int prop, int *value)
 	STORE_U8(0x11);
 	STORE_U16(prop);
 
-	si46xx_write_data(SI46XX_FLASH_LOAD, data, sizeof(data));
-	ret = si46xx_read(buf, sizeof(buf));
+	ret = si46xx_command(SI46XX_FLASH_LOAD, data, sizeof(data),
+		buf, sizeof(buf));
 	if (ret)
 		return ret;
 
@@ -1241,16 +1856,18 @@ int si46xx_flash_property_get(int prop, int *value)
 	return 0;
 }
 
-#define MAX_BLOCK_SIZE	4084
 int si46xx_flash_write(int offset, char *ptr, int size, uint32_t crc, int verify)
 {
 	int i = 0;
 	int ret;
-	uint8_t data[MAX_BLOCK_SIZE + 16]; //header
+	/* build frame in place, header + data */
+	uint8_t *data = ARENA_ARGS;
 
 	if (size > MAX_BLOCK_SIZE)
 		return -EINVAL;
 
+	si46xx_flash_changed(offset, size);
+
 	/* header */
 	if (verify)
 		STORE_U8(0xF1);
@@ -1268,8 +1885,13 @@ int si46xx_flash_write(int offset, char *ptr, int size, uint32_t crc, int verify
 	memcpy(&data[i], ptr, size);
 	i += size;
 
-	si46xx_write_data(SI46XX_FLASH_LOAD, data, i);
-	return si46xx_read(NULL, ret);
+	spi_set_phase(SPI_PHASE_LOAD);
+	prof_begin(PROF_FLASH_WRITE);
+	ret = si46xx_command(SI46XX_FLASH_LOAD, data, i, NULL, 4);
+	prof_end(PROF_FLASH_WRITE);
+	spi_set_phase(SPI_PHASE_BOOT);
+
+	return ret;
 }
 
 int si46xx_flash_load(int offset)
@@ -1288,8 +1910,205 @@ int si46xx_flash_load(int offset)
 	/*  */
 	STORE_U32(0);
 
-	si46xx_write_data(SI46XX_FLASH_LOAD, data, i);
-	return si46xx_read(NULL, 4);
+	prof_begin(PROF_FLASH_LOAD);
+	ret = si46xx_command(SI46XX_FLASH_LOAD, data, i, NULL, 4);
+	prof_end(PROF_FLASH_LOAD);
+	return ret;
+}
+
+static const char *spi_phase_names[SPI_PHASE_NUM] = {
+	"boot",
+	"load",
+	"app",
+};
+
+/* flash write block size measured by si_flash, 0 if not yet */
+static int flash_block;
+
+/*
+ * SPI clock profile, one "<phase>=<Hz>" line per phase, and the flash
+ * write block size as "flash_block=<bytes>"
+ */
+static int si46xx_spi_profile_load(const char *path)
+{
+	char line[64];
+	char name[16];
+	FILE *fp;
+	int speed;
+	int i;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return -errno;
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%15[a-z_]=%d", name, &speed) != 2)
+			continue;
+		if (strcmp(name, "flash_block") == 0)
+			flash_block = speed;
+		for (i = 0; i < SPI_PHASE_NUM; i++)
+			if (strcmp(name, spi_phase_names[i]) == 0)
+				spi_set_speed(i, speed);
+	}
+	fclose(fp);
+
+	printf("SPI clock boot %d, load %d, app %d Hz\n",
+		spi_get_speed(SPI_PHASE_BOOT),
+		spi_get_speed(SPI_PHASE_LOAD),
+		spi_get_speed(SPI_PHASE_APP));
+	return 0;
+}
+
+static int si46xx_spi_profile_save(const char *path)
+{
+	FILE *fp;
+	int i;
+
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		printf("Can not write %s: %s\n", path, strerror(errno));
+		return -errno;
+	}
+	fprintf(fp, "# si46xx SPI clock, Hz\n");
+	for (i = 0; i < SPI_PHASE_NUM; i++)
+		fprintf(fp, "%s=%d\n", spi_phase_names[i], spi_get_speed(i));
+	if (flash_block)
+		fprintf(fp, "flash_block=%d\n", flash_block);
+	fclose(fp);
+
+	return 0;
+}
+
+/*
+ * Largest flash write block: command limit, and a frame has to fit one
+ * spidev transfer
+ */
+int si46xx_flash_block_max(void)
+{
+	int max = MAX_BLOCK_SIZE;
+
+	if ((bus == &spi_bus) &&
+	    (spi_get_bufsiz() - FLASH_WRITE_HDR < max))
+		max = spi_get_bufsiz() - FLASH_WRITE_HDR;
+	return max;
+}
+
+int si46xx_flash_block_get(void)
+{
+	if (flash_block > si46xx_flash_block_max())
+		return si46xx_flash_block_max();
+	return flash_block;
+}
+
+/* remember block size of this board in the SPI profile */
+int si46xx_flash_block_set(int size)
+{
+	flash_block = size;
+	if (bus != &spi_bus)
+		return 0;
+	return si46xx_spi_profile_save(SPI_PROFILE_PATH);
+}
+
+/* candidate clocks for probing, Hz */
+static const int spi_probe_speeds[] = {
+	1000000, 5000000, 10000000, 12500000, 16000000,
+	20000000, 25000000, 33000000, 40000000, 50000000,
+};
+#define SPI_PROBE_ROUNDS	32
+#define SPI_PROBE_PART_LEN	22
+#define SPI_PROBE_STATE_LEN	6
+
+/*
+ * Replies have to match the ones read at lowest clock. Only data bytes
+ * are compared, status interrupt bits may change in between.
+ */
+static int si46xx_spi_probe_check(const uint8_t *part, const uint8_t *state)
+{
+	uint8_t zero = 0;
+	uint8_t buf[SPI_PROBE_PART_LEN];
+	int i;
+
+	for (i = 0; i < SPI_PROBE_ROUNDS; i++) {
+		if (si46xx_command(SI46XX_GET_PART_INFO, &zero, 1,
+				buf, SPI_PROBE_PART_LEN) ||
+		    ((buf[0] & 0xC0) != 0x80) ||
+		    memcmp(buf + 4, part + 4, SPI_PROBE_PART_LEN - 4))
+			return -EIO;
+		if (si46xx_command(SI46XX_GET_SYS_STATE, &zero, 1,
+				buf, SPI_PROBE_STATE_LEN) ||
+		    ((buf[0] & 0xC0) != 0x80) ||
+		    memcmp(buf + 4, state + 4, SPI_PROBE_STATE_LEN - 4))
+			return -EIO;
+	}
+	return 0;
+}
+
+/*
+ * Raise the clock of current chip phase until replies get corrupted and
+ * save the fastest good one to the profile. In bootloader mode this sets
+ * boot and load clock (HOST_LOAD can not be read back), with firmware
+ * running the app clock.
+ */
+int si46xx_spi_probe(void)
+{
+	uint8_t zero = 0;
+	uint8_t part[SPI_PROBE_PART_LEN];
+	uint8_t state[SPI_PROBE_STATE_LEN];
+	int phase;
+	int mode;
+	int best = 0;
+	int ret;
+	unsigned int i;
+
+	if (bus != &spi_bus) {
+		printf("SPI probe needs SPI interface\n");
+		return -EINVAL;
+	}
+
+	mode = si46xx_get_sys_mode();
+	if (mode < 0)
+		return mode;
+	phase = (mode == SI46XX_MODE_BOOT) ? SPI_PHASE_BOOT : SPI_PHASE_APP;
+
+	/* reference replies */
+	spi_set_speed(phase, spi_probe_speeds[0]);
+	ret = si46xx_command(SI46XX_GET_PART_INFO, &zero, 1,
+		part, sizeof(part));
+	if (ret == 0)
+		ret = si46xx_command(SI46XX_GET_SYS_STATE, &zero, 1,
+			state, sizeof(state));
+	if (ret) {
+		printf("SPI probe: no reply at %d Hz: %d\n",
+			spi_probe_speeds[0], ret);
+		return ret;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(spi_probe_speeds); i++) {
+		ret = spi_set_speed(phase, spi_probe_speeds[i]);
+		if (ret)
+			break;
+		ret = si46xx_spi_probe_check(part, state);
+		printf("SPI probe %s %8d Hz: %s\n", spi_phase_names[phase],
+			spi_probe_speeds[i], ret ? "failed" : "ok");
+		if (ret)
+			break;
+		best = spi_probe_speeds[i];
+	}
+
+	/* resync at last good clock */
+	spi_set_speed(phase, best ? best : spi_probe_speeds[0]);
+	cts_ready = 0;
+	ret = si46xx_read(NULL, 4);
+	if ((ret) || (!best)) {
+		printf("SPI probe failed\n");
+		return ret ? ret : -EIO;
+	}
+
+	if (phase == SPI_PHASE_BOOT)
+		spi_set_speed(SPI_PHASE_LOAD, best);
+	printf("SPI %s clock %d Hz\n", spi_phase_names[phase], best);
+
+	return si46xx_spi_profile_save(SPI_PROFILE_PATH);
 }
 
 int si46xx_init(int argc, char **argv)
@@ -1299,6 +2118,8 @@ int si46xx_init(int argc, char **argv)
 	if (argc < 2)
 		return 0;
 
+	fw_manifest_load(FW_MANIFEST_PATH);
+
 	/* check interface */
 	if (strstr(argv[1], "spi")) {
 		/* 10 MHz, mode = 0 */
@@ -1308,7 +2129,17 @@ int si46xx_init(int argc, char **argv)
 			printf("Setup SPI error: %d\n", ret);
 			return ret;
 		}
+		bus = &spi_bus;
+		si46xx_spi_profile_load(SPI_PROFILE_PATH);
 		/* used arguments */
+	} else if (strncmp(argv[1], "sim", 3) == 0) {
+		/* sim[:key=value,...] */
+		ret = sim_init(argv[1]);
+		if (ret) {
+			printf("Setup simulator error: %d\n", ret);
+			return ret;
+		}
+		bus = &sim_bus;
 	} else if (strstr(argv[1], "i2c")) {
 		int addr;
 
@@ -1323,11 +2154,12 @@ int si46xx_init(int argc, char **argv)
 			return addr;
 		}
 
-		ret = i2c_init(argv[1], addr, 0 /* don't care now */);
+		ret = i2c_init(argv[1], addr, I2C_DEV_SPEED);
 		if (ret) {
 			printf("Setup I2C error: %d\n", ret);
 			return ret;
 		}
+		bus = &i2c_bus;
 
 		/* used arguments */
 		return 2;
@@ -1335,38 +2167,175 @@ int si46xx_init(int argc, char **argv)
 	return 0;
 }
 
+/*
+ * Enable INTB for command and tune completion, app mode only. RDS and
+ * service interrupts stay off, nothing acknowledges them.
+ */
+int si46xx_int_enable(void)
+{
+	int ret;
+
+	if (!gpio_intb_fd)
+		return 0;
+
+	ret = si46xx_set_property(SI46XX_FM_INT_CTL_ENABLE,
+		SI46XX_INT_CTSIEN | SI46XX_INT_STCIEN);
+	if (ret == 0)
+		intb_enabled = 1;
+	return ret;
+}
+
+int si46xx_intb_init(const char *spec)
+{
+	int ret;
+	int mode;
+
+	ret = gpio_intb_init(spec);
+	if (ret)
+		return ret;
+
+	/* firmware may be running already */
+	mode = si46xx_get_sys_mode();
+	if ((mode == SI46XX_MODE_AM) || (mode == SI46XX_MODE_FM) ||
+	    (mode == SI46XX_MODE_DAB))
+		return si46xx_int_enable();
+
+	return 0;
+}
+
 int si46xx_init_patch(void)
 {
 	int ret;
 	int mode;
+	struct fw_info *info;
 
 	printf("si46xx_init_patch()\n");
 
 	mode = si46xx_get_sys_mode();
+	info = fw_info_file(FIRMWARE_PATH, "patch.bin");
 
-	if (mode != SI46XX_MODE_BOOT) {
-		if (mode == SI46XX_MODE_UNK) {
-			ret = si46xx_powerup();
-			if (ret) {
-				printf("Power up failed\n");
-				return ret;
-			}
+	if (mode == SI46XX_MODE_BOOT) {
+		/* skipped only on a revision known to match */
+		if (si46xx_image_running(info))
+			return 0;
+		printf("Bootloader not known patched with patch.bin\n");
+	} else if (mode == SI46XX_MODE_UNK) {
+		ret = si46xx_powerup();
+		if (ret) {
+			printf("Power up failed\n");
+			return ret;
 		}
+	}
+
+	prof_begin(PROF_PATCH);
+	ret = store_image_from_file(FIRMWARE_PATH "patch.bin", 0);
+	if (ret == 0)
+		wait_until(cmd_sent + SI46XX_PATCH_SETTLE_US);
+	prof_end(PROF_PATCH);
+	if (ret) {
+		printf("Patch load failed\n");
+		return ret;
+	}
+	si46xx_image_booted(info);
+	return 0;
+}
+
+/*
+ * Patch from flash at offset, as written there by si_flash, without any
+ * host file access
+ */
+static int si46xx_init_patch_flash(int offset)
+{
+	int ret;
+	int mode;
+	char name[FW_INFO_NAME_LEN];
+	struct fw_info *info;
+
+	printf("si46xx_init_patch_flash(0x%08x)\n", offset);
+
+	snprintf(name, sizeof(name), FW_INFO_FLASH, offset);
+	info = fw_info_get(name);
+	mode = si46xx_get_sys_mode();
 
-		ret = store_image_from_file(FIRMWARE_PATH "patch.bin", 0);
+	if (mode == SI46XX_MODE_BOOT) {
+		/* skipped only on a revision known to match */
+		if (si46xx_image_running(info))
+			return 0;
+		printf("Bootloader not known patched from %s\n", name);
+	} else if (mode == SI46XX_MODE_UNK) {
+		ret = si46xx_powerup();
 		if (ret) {
-			printf("Patch load failed\n");
+			printf("Power up failed\n");
 			return ret;
 		}
 	}
+
+	prof_begin(PROF_PATCH);
+	ret = si46xx_load_init();
+	if (ret == 0)
+		ret = si46xx_flash_load(offset);
+	if (ret == 0)
+		wait_until(cmd_sent + SI46XX_PATCH_SETTLE_US);
+	prof_end(PROF_PATCH);
+	if (ret) {
+		printf("Patch load from flash failed\n");
+		return ret;
+	}
+	si46xx_image_booted(info);
 	return 0;
 }
 
+static const char *si46xx_mode_image(int mode)
+{
+	switch (mode) {
+	case SI46XX_MODE_FM:
+		return "fm.bif";
+	case SI46XX_MODE_DAB:
+		return "dab.bif";
+	case SI46XX_MODE_AM:
+		return "am.bif";
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * Print state of booted chip, left to the caller in fast boot
+ */
+int si46xx_boot_info(void)
+{
+	int ret;
+
+	ret = si46xx_get_sys_state();
+	if (ret) {
+		printf("Get sys state failed\n");
+		return ret;
+	}
+	ret = si46xx_get_part_info();
+	if (ret) {
+		printf("Get part info failed\n");
+		return ret;
+	}
+	return 0;
+}
+
+/*
+ * Fast boot: nothing but what audio needs is done on boot, no printing
+ * of properties set
+ */
+void si46xx_set_fast_boot(int enable)
+{
+	fast_boot = enable;
+}
+
 int si46xx_init_mode(int mode)
 {
 	int ret;
-	int cur_mode;
-	uint8_t read_data[30];
+	char path[256];
+	const char *image;
+	struct fw_info *info = NULL;
+	uint64_t start;
+
 	printf("si46xx_init_mode(%d)\n", mode);
 #if 0
 	/* reset si46xx  */
@@ -1375,9 +2344,18 @@ int si46xx_init_mode(int mode)
 	RESET_HIGH();
 	msleep(10);
 #endif
+	image = si46xx_mode_image(mode);
+	if (image)
+		info = fw_info_file(FIRMWARE_PATH, image);
+
 	if (mode == si46xx_get_sys_mode()) {
-		printf("skip!\n");
-		return 0;
+		/* without a revision from earlier boot trust the mode */
+		if ((info == NULL) || (!info->rev_valid) ||
+		    (si46xx_image_running(info))) {
+			printf("skip!\n");
+			return 0;
+		}
+		printf("Running firmware is not %s\n", image);
 	}
 
 	ret = si46xx_init_patch();
@@ -1391,50 +2369,64 @@ int si46xx_init_mode(int mode)
 		return ret;
 	}
 
-	if (mode == SI46XX_MODE_FM) {
-		ret = store_image_from_file(FIRMWARE_PATH "fm.bif", 0);
-	} else if (mode == SI46XX_MODE_DAB) {
-		ret = store_image_from_file(FIRMWARE_PATH "dab.bif", 0);
-	} else if (mode == SI46XX_MODE_AM) {
-		ret = store_image_from_file(FIRMWARE_PATH "am.bif", 0);
-	} else {
+	if (image == NULL) {
 		printf("Mode %d not supported\n", mode);
+		return -EINVAL;
 	}
+	snprintf(path, sizeof(path), "%s%s", FIRMWARE_PATH, image);
+	start = wait_now();
+	prof_begin(PROF_IMAGE);
+	ret = store_image_from_file(path, 0);
+	prof_end(PROF_IMAGE);
 	if (ret) {
 		printf("Firmware load failed\n");
 		return ret;
 	}
 
-	ret = si46xx_boot();
+	ret = si46xx_boot(mode);
 	if (ret) {
 		printf("BOOT failed\n");
 		return ret;
 	}
-	ret = si46xx_get_sys_state();
-	if (ret) {
-		printf("Get sys state failed\n");
-		return ret;
-	}
-	ret = si46xx_get_part_info();
+	if (info)
+		fw_info_set_time(info, wait_now() - start);
+	si46xx_image_booted(info);
+	ret = si46xx_int_enable();
 	if (ret) {
-		printf("Get part info failed\n");
+		printf("Interrupt enable failed\n");
 		return ret;
 	}
+	if (fast_boot)
+		return 0;
 
-	return 0;
+	return si46xx_boot_info();
 }
 
 
 int si46xx_boot_flash(int offset)
 {
 	int ret;
+	int mode;
+	char name[FW_INFO_NAME_LEN];
+	struct fw_info *info;
+	uint64_t start;
 
 	printf("si46xx_boot_flash(0x%08x)\n", offset);
 
-	ret = si46xx_init_patch();
+	snprintf(name, sizeof(name), FW_INFO_FLASH, offset);
+	info = fw_info_get(name);
+	mode = si46xx_get_sys_mode();
+	if (((mode == SI46XX_MODE_AM) || (mode == SI46XX_MODE_FM) ||
+	     (mode == SI46XX_MODE_DAB)) && (si46xx_image_running(info))) {
+		printf("skip!\n");
+		return 0;
+	}
+
+	ret = si46xx_init_patch_flash(FLASH_OFFSET_PATCH_016);
 	if (ret)
 		return ret;
 
+	start = wait_now();
 	ret = si46xx_load_init();
 	if (ret) {
 		printf("LOAD_INIT failed\n");
@@ -1447,11 +2439,320 @@ int si46xx_boot_flash(int offset)
 		return ret;
 	}
 
-	ret = si46xx_boot();
+	if (offset == FLASH_OFFSET_FM)
+		mode = SI46XX_MODE_FM;
+	else if (offset == FLASH_OFFSET_DAB)
+		mode = SI46XX_MODE_DAB;
+	else if (offset == FLASH_OFFSET_AM)
+		mode = SI46XX_MODE_AM;
+	else
+		mode = SI46XX_MODE_UNK;
+	ret = si46xx_boot(mode);
 	if (ret) {
 		printf("BOOT failed\n");
 		return ret;
 	}
+	fw_info_set_time(info, wait_now() - start);
+	si46xx_image_booted(info);
+
+	return si46xx_int_enable();
+}
+
+/*
+ * Boot path of mode: flash offset when the flash holds the current image
+ * file and booting it is not slower, -1 to load the file from host. A
+ * path not timed yet is taken once, so both get measured.
+ */
+int si46xx_boot_select(int mode)
+{
+	char name[FW_INFO_NAME_LEN];
+	const char *image = si46xx_mode_image(mode);
+	struct fw_info *file;
+	struct fw_info *flash;
+	int offset;
+
+	if (mode == SI46XX_MODE_FM)
+		offset = FLASH_OFFSET_FM;
+	else if (mode == SI46XX_MODE_DAB)
+		offset = FLASH_OFFSET_DAB;
+	else if (mode == SI46XX_MODE_AM)
+		offset = FLASH_OFFSET_AM;
+	else
+		return -1;
+
+	snprintf(name, sizeof(name), FW_INFO_FLASH, offset);
+	flash = fw_info_find(name);
+	file = fw_info_file(FIRMWARE_PATH, image);
+	if (file == NULL) {
+		printf("Boot path: flash, no %s\n", image);
+		return offset;
+	}
+	if ((flash == NULL) || (flash->crc != file->crc)) {
+		printf("Boot path: host, flash does not hold %s\n", image);
+		return -1;
+	}
+
+	printf("Boot path: flash %u us, host %u us\n", flash->boot_us,
+		file->boot_us);
+	if ((flash->boot_us) && (file->boot_us) &&
+	    (flash->boot_us > file->boot_us))
+		return -1;
+	if ((flash->boot_us) && (!file->boot_us))
+		return -1;
+	return offset;
+}
+
+/*
+ * Send pre-built command frame, waiting for CTS of previous command
+ */
+static int si46xx_send_frame(const uint8_t *frame, int len)
+{
+	int ret;
+
+	if (!cts_ready) {
+		ret = si46xx_read(NULL, 4);
+		if (ret)
+			return ret;
+	}
+	cts_ready = 0;
+	si46xx_cmd_start(frame, len);
+	return si46xx_bus_write(frame, len);
+}
+
+static const struct bundle_record *bundle_next(const struct bundle_record *rec)
+{
+	return (const void *)((const uint8_t *)(rec + 1) + BUNDLE_PAD(rec->len));
+}
+
+/*
+ * Check bundle header, record bounds and crc, find image section
+ */
+static int bundle_check(const uint8_t *map, size_t size, int mode,
+		const struct bundle_section **image)
+{
+	const struct bundle_header *hdr = (const void *)map;
+	const struct bundle_record *rec;
+	const uint8_t *end;
+	uint32_t i;
+
+	if ((size < sizeof(*hdr)) ||
+	    (memcmp(hdr->magic, BUNDLE_MAGIC, sizeof(hdr->magic))) ||
+	    (hdr->version != BUNDLE_VERSION) ||
+	    (hdr->size > size - sizeof(*hdr))) {
+		printf("Not a boot bundle\n");
+		return -EINVAL;
+	}
+	if (hdr->mode != mode) {
+		printf("Bundle is for mode %d\n", hdr->mode);
+		return -EINVAL;
+	}
+	if (crc32(0, hdr + 1, hdr->size) != hdr->crc) {
+		printf("Bundle crc error\n");
+		return -EINVAL;
+	}
+
+	*image = NULL;
+	end = (const uint8_t *)(hdr + 1) + hdr->size;
+	rec = (const void *)(hdr + 1);
+	for (i = 0; i < hdr->records; i++) {
+		if (((const uint8_t *)(rec + 1) > end) ||
+		    ((const uint8_t *)(rec + 1) + rec->len > end) ||
+		    (((rec->kind == BUNDLE_CMD) || (rec->kind == BUNDLE_LOAD)) &&
+		     ((rec->len == 0) || (rec->len > SI46XX_FRAME_SIZE))) ||
+		    ((rec->kind == BUNDLE_SECTION) &&
+		     (rec->len != sizeof(struct bundle_section))) ||
+		    ((rec->kind == BUNDLE_WAIT) && (rec->len != 4))) {
+			printf("Bundle record %u broken\n", i);
+			return -EINVAL;
+		}
+		if ((rec->kind == BUNDLE_SECTION) &&
+		    (((const struct bundle_section *)(rec + 1))->type ==
+		     BUNDLE_SEC_IMAGE))
+			*image = (const void *)(rec + 1);
+		rec = bundle_next(rec);
+	}
+	if (*image == NULL) {
+		printf("Bundle without image\n");
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/* source name of section, for manifest */
+static struct fw_info *bundle_info(const struct bundle_section *sec)
+{
+	char name[sizeof(sec->name) + 1];
+
+	memcpy(name, sec->name, sizeof(sec->name));
+	name[sizeof(sec->name)] = 0;
+	return fw_info_crc(name, sec->crc);
+}
+
+/*
+ * Boot mode from bundle built by si_bundle: frames are sent straight
+ * from the mapped file. As with firmware files, patch and image are
+ * skipped when the chip runs them already, properties are always set.
+ */
+int si46xx_init_bundle(const char *path, int mode)
+{
+	const struct bundle_header *hdr;
+	const struct bundle_record *rec;
+	const struct bundle_section *image_sec;
+	const struct bundle_section *sec;
+	const uint8_t *frame;
+	struct fw_info *image;
+	struct fw_info *patch = NULL;
+	struct stat st;
+	uint8_t *map;
+	char buf[4];
+	int cur_mode;
+	int skip_image;
+	int skip = 0;
+	int loading = 0;
+	int section = -1;
+	uint32_t us;
+	uint32_t i;
+	int ret;
+	int fd;
+
+	printf("si46xx_init_bundle(%s)\n", path);
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		printf("file error %s: %d\n", path, errno);
+		return -errno;
+	}
+	if ((fstat(fd, &st) < 0) || (st.st_size == 0)) {
+		printf("file error %s: %d\n", path, errno);
+		close(fd);
+		return -EINVAL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		printf("mmap %s failed: %d\n", path, errno);
+		return -errno;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	madvise(map, st.st_size, MADV_WILLNEED);
+
+	ret = bundle_check(map, st.st_size, mode, &image_sec);
+	if (ret)
+		goto out;
+	hdr = (const void *)map;
+
+	image = bundle_info(image_sec);
+	cur_mode = si46xx_get_sys_mode();
+	/* without a revision from earlier boot trust the mode */
+	skip_image = (cur_mode == mode) && ((!image->rev_valid) ||
+		(si46xx_image_running(image)));
+	if (skip_image)
+		printf("skip!\n");
+	else if (cur_mode == SI46XX_MODE_UNK)
+		ret = si46xx_powerup();
+	if (ret) {
+		printf("Power up failed\n");
+		goto out;
+	}
+
+	rec = (const void *)(hdr + 1);
+	for (i = 0; (i < hdr->records) && (ret == 0); i++,
+	     rec = bundle_next(rec)) {
+		frame = (const uint8_t *)(rec + 1);
+
+		/* HOST_LOAD series ends, check its reply */
+		if ((loading) && (rec->kind != BUNDLE_LOAD)) {
+			loading = 0;
+			spi_set_phase(SPI_PHASE_BOOT);
+			ret = si46xx_read_reply(buf, sizeof(buf));
+			if (ret) {
+				printf("Load firmware failed\n");
+				break;
+			}
+		}
+
+		if (rec->kind == BUNDLE_SECTION) {
+			if (section >= 0)
+				prof_end(section);
+			section = -1;
+			if (patch) {
+				si46xx_image_booted(patch);
+				patch = NULL;
+			}
+			sec = (const void *)frame;
+			if (sec->type == BUNDLE_SEC_PATCH) {
+				patch = bundle_info(sec);
+				skip = skip_image;
+				/* bootloader known patched with it */
+				if ((cur_mode == SI46XX_MODE_BOOT) &&
+				    (si46xx_image_running(patch)))
+					skip = 1;
+				if (skip)
+					patch = NULL;
+				else
+					section = PROF_PATCH;
+			} else if (sec->type == BUNDLE_SEC_IMAGE) {
+				skip = skip_image;
+				if (!skip)
+					section = PROF_IMAGE;
+			} else {
+				skip = 0;
+			}
+			if (section >= 0)
+				prof_begin(section);
+			continue;
+		}
+		if (skip)
+			continue;
+
+		switch (rec->kind) {
+		case BUNDLE_LOAD:
+			if (!loading)
+				spi_set_phase(SPI_PHASE_LOAD);
+			loading = 1;
+			prof_begin(PROF_HOST_LOAD);
+			cts_ready = 0;
+			si46xx_cmd_start(frame, rec->len);
+			ret = si46xx_bus_write(frame, rec->len);
+			prof_end(PROF_HOST_LOAD);
+			break;
+		case BUNDLE_CMD:
+			if (frame[0] == SI46XX_BOOT) {
+				if (section == PROF_IMAGE)
+					prof_end(section);
+				section = -1;
+				prof_begin(PROF_BOOT);
+			}
+			ret = si46xx_send_frame(frame, rec->len);
+			if (ret)
+				break;
+			if (frame[0] == SI46XX_BOOT) {
+				ret = si46xx_boot_wait(mode);
+				if (ret == 0)
+					si46xx_image_booted(image);
+			} else {
+				ret = si46xx_read_reply(buf, sizeof(buf));
+			}
+			if (ret)
+				printf("Bundle command 0x%02x failed: %d\n",
+					frame[0], ret);
+			break;
+		case BUNDLE_WAIT:
+			memcpy(&us, frame, sizeof(us));
+			wait_until(cmd_sent + us);
+			break;
+		}
+	}
+	if (section >= 0)
+		prof_end(section);
+	if ((ret == 0) && (loading)) {
+		spi_set_phase(SPI_PHASE_BOOT);
+		ret = si46xx_read_reply(buf, sizeof(buf));
+	}
+	if ((ret == 0) && (!skip_image))
+		ret = si46xx_int_enable();
 
+out:
+	munmap(map, st.st_size);
 	return ret;
 }
@@ -22,7 +22,16 @@
 
 #define SPI_DEV_PATH		"/dev/spidev32766.0"
 #define SPI_DEV_SPEED		(10 *1000 * 1000)
+#define I2C_DEV_SPEED		(400 * 1000)
+#ifndef SPI_PROFILE_PATH
+#define SPI_PROFILE_PATH	"/data/vendor/si46xx/spi_profile"
+#endif
+#ifndef FIRMWARE_PATH
 #define FIRMWARE_PATH		"/vendor/etc/firmware/si46xx/"
+#endif
+
+/* patch is applied after its last HOST_LOAD, nothing is sent meanwhile */
+#define SI46XX_PATCH_SETTLE_US	4000
 
 #define SI46XX_MODE_UNK		0
 #define SI46XX_MODE_BOOT	1
@@ -38,6 +47,9 @@
 #define FLASH_OFFSET_FM         0x00006000
 #define FLASH_OFFSET_DAB        0x00086000
 #define FLASH_OFFSET_AM		0x00106000
+#define FLASH_SECTOR_SIZE	0x1000
+/* crc granularity of delta writes */
+#define FLASH_DELTA_BLOCK_SIZE	2048
 
 #define SI46XX_RD_REPLY 0x00
 #define SI46XX_POWER_UP 0x01
@@ -47,6 +59,7 @@
 #define SI46XX_BOOT 0x07
 #define SI46XX_GET_PART_INFO 0x08
 #define SI46XX_GET_SYS_STATE 0x09
+#define SI46XX_GET_FUNC_INFO 0x12
 #define SI46XX_SET_PROPERTY 0x13
 #define SI46XX_GET_PROPERTY 0x14
 #define SI46XX_FM_TUNE_FREQ 0x30
@@ -75,6 +88,27 @@
 #define SI46XX_AM_VALID_RSSI_THRESHOLD 0x4202
 #define SI46XX_AM_VALID_SNR_THRESHOLD 0x4204
 
+/* STATUS0 bits */
+#define SI46XX_STATUS_CTS	(1 << 7)
+#define SI46XX_STATUS_ERR_CMD	(1 << 6)
+#define SI46XX_STATUS_DACQINT	(1 << 5)
+#define SI46XX_STATUS_DSRVINT	(1 << 4)
+#define SI46XX_STATUS_RSQINT	(1 << 3)
+#define SI46XX_STATUS_RDSINT	(1 << 2)
+#define SI46XX_STATUS_ACFINT	(1 << 1)
+#define SI46XX_STATUS_STCINT	(1 << 0)
+#define SI46XX_STATUS_INT_MASK	0x3F
+
+/* INT_CTL_ENABLE bits */
+#define SI46XX_INT_CTSIEN	(1 << 7)
+#define SI46XX_INT_ERR_CMDIEN	(1 << 6)
+#define SI46XX_INT_DACQIEN	(1 << 5)
+#define SI46XX_INT_DSRVIEN	(1 << 4)
+#define SI46XX_INT_RSQIEN	(1 << 3)
+#define SI46XX_INT_RDSIEN	(1 << 2)
+#define SI46XX_INT_ACFIEN	(1 << 1)
+#define SI46XX_INT_STCIEN	(1 << 0)
+
 #define SI46XX_FM_INT_CTL_ENABLE 0x0000
 #define SI46XX_FM_INT_CTL_REPEAT 0x0001
 #define SI46XX_DIGITAL_IO_OUTPUT_SELECT 0x0200
@@ -196,18 +230,31 @@ struct fm_rds_data_t{
 	char radiotext[129];
 	uint16_t group_0a_flags;
 	uint32_t group_2a_flags;
-}fm_rds_data;
+};
 
 struct dab_service_list_t{
 	uint16_t list_size;
 	uint16_t version;
 	uint8_t num_services;
 	struct dab_service_t services[MAX_SERVICES];
-}dab_service_list;
+};
+
+struct fw_blocks;
+
+extern struct fm_rds_data_t fm_rds_data;
+extern struct dab_service_list_t dab_service_list;
 
 int si46xx_init(int argc, char **argv);
 int si46xx_init_mode(int mode);
 int si46xx_boot_flash(int offset);
+int si46xx_boot_select(int mode);
+int si46xx_init_bundle(const char *path, int mode);
+int si46xx_boot_info(void);
+void si46xx_set_fast_boot(int enable);
+int si46xx_intb_init(const char *spec);
+int si46xx_int_enable(void);
+uint8_t si46xx_status_take(uint8_t mask);
+int si46xx_spi_probe(void);
 int si46xx_get_sys_state(void);
 int si46xx_get_sys_mode(void);
 int si46xx_fm_tune_freq(uint32_t khz, uint16_t antcap);
@@ -240,6 +287,12 @@ int si46xx_flash_erase_sector(int addr);
 int si46xx_flash_property_get(int prop, int *value);
 int si46xx_flash_write(int offset, char *ptr, int size, uint32_t crc, int verify);
 int si46xx_flash_load(int offset);
+void si46xx_flash_forget(int offset, int size);
+void si46xx_flash_written(int offset, const void *buf, int size);
+int si46xx_flash_blocks(int offset, struct fw_blocks *blocks);
+int si46xx_flash_block_max(void);
+int si46xx_flash_block_get(void);
+int si46xx_flash_block_set(int size);
 
 
 void si46xx_dab_scan();
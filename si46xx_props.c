@@ -154,3 +154,63 @@ char *si46xx_property_name(int id, int mode)
 
 	return NULL;
 }
+
+/*
+ * Properties set after boot, for I2S master. Used by si_ctl and packed
+ * into boot bundles by si_bundle. Deferred ones are not needed for
+ * audio and can be set after the first tune.
+ */
+static const struct si46xx_prop_value si46xx_fm_init_props[] = {
+	{ SI46XX_PIN_CONFIG_ENABLE,		0x0003, 0 },	/* I2S output */
+	{ SI46XX_FM_SOFTMUTE_SNR_LIMITS,	0x0000, 1 },
+	{ SI46XX_FM_TUNE_FE_CFG,		0x0000, 0 },	/* switch open */
+	{ SI46XX_FM_SEEK_BAND_BOTTOM,		88000 / 10, 1 },
+	{ SI46XX_FM_SEEK_BAND_TOP,		108000 / 10, 1 },
+	{ SI46XX_DIGITAL_IO_OUTPUT_SELECT,	0x8000, 0 },
+	/* sample size 16, slot size 16, right_j mode */
+	{ SI46XX_DIGITAL_IO_OUTPUT_FORMAT,	(16 << 8) | (4 << 4) | 0, 0 },
+	{ SI46XX_FM_RDS_CONFIG,			0x0001, 1 },
+	{ SI46XX_FM_AUDIO_DE_EMPHASIS,		SI46XX_AUDIO_DE_EMPHASIS_EU, 0 },
+};
+
+static const struct si46xx_prop_value si46xx_am_init_props[] = {
+	{ SI46XX_PIN_CONFIG_ENABLE,		0x0003, 0 },	/* I2S output */
+	{ SI46XX_AM_SEEK_FREQUENCY_SPACING,	1, 1 },
+	{ SI46XX_AM_SEEK_BAND_BOTTOM,		500, 1 },
+	{ SI46XX_AM_SEEK_BAND_TOP,		1700, 1 },
+	{ SI46XX_AM_VALID_RSSI_THRESHOLD,	15, 1 },
+	{ SI46XX_AM_VALID_SNR_THRESHOLD,	2, 1 },
+	{ SI46XX_DIGITAL_IO_OUTPUT_SELECT,	0x8000, 0 },
+	/* sample size 16, slot size 16, right_j mode */
+	{ SI46XX_DIGITAL_IO_OUTPUT_FORMAT,	(16 << 8) | (4 << 4) | 0, 0 },
+};
+
+static const struct si46xx_prop_value si46xx_dab_init_props[] = {
+	{ SI46XX_DAB_CTRL_DAB_MUTE_SIGNAL_LEVEL_THRESHOLD, 0, 0 },
+	{ SI46XX_DAB_CTRL_DAB_MUTE_SIGLOW_THRESHOLD, 0, 0 },
+	{ SI46XX_DAB_CTRL_DAB_MUTE_ENABLE,	0, 0 },
+	{ SI46XX_DIGITAL_SERVICE_INT_SOURCE,	1, 1 },	/* DSRVPAKTINT */
+	{ SI46XX_DAB_TUNE_FE_CFG,		0x0001, 0 },	/* switch closed */
+	/* varactor, changed from 10 for sensitivity (Bjoern 27.11.14) */
+	{ SI46XX_DAB_TUNE_FE_VARM,		0x1710, 0 },
+	{ SI46XX_DAB_TUNE_FE_VARB,		0x1711, 0 },
+	{ SI46XX_PIN_CONFIG_ENABLE,		0x0003, 0 },	/* I2S output */
+};
+
+int si46xx_init_props(int mode, const struct si46xx_prop_value **props)
+{
+	switch (mode) {
+	case SI46XX_MODE_FM:
+		*props = si46xx_fm_init_props;
+		return ARRAY_SIZE(si46xx_fm_init_props);
+	case SI46XX_MODE_AM:
+		*props = si46xx_am_init_props;
+		return ARRAY_SIZE(si46xx_am_init_props);
+	case SI46XX_MODE_DAB:
+		*props = si46xx_dab_init_props;
+		return ARRAY_SIZE(si46xx_dab_init_props);
+	default:
+		*props = NULL;
+		return 0;
+	}
+}
@@ -1,7 +1,16 @@
 #ifndef __SI86XX_PROPS_H__
 #define __SI86XX_PROPS_H__
 
+#include <stdint.h>
+
+struct si46xx_prop_value {
+	uint16_t id;
+	uint16_t value;
+	uint8_t deferred;	/* not needed for audio */
+};
+
 char *si46xx_property_name(int id, int mode);
+int si46xx_init_props(int mode, const struct si46xx_prop_value **props);
 
 /* common */
 #define INT_CTL_ENABLE	0x0000
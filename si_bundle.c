@@ -0,0 +1,253 @@
+/*
+ * si_bundle - pack patch, firmware and post-boot properties of one mode
+ * into a boot bundle (see bundle.h) for si_ctl -u
+ *
+ * Everything the runtime would do per boot is done here once: firmware
+ * selection, chunking, HOST_LOAD header construction and property
+ * encoding. The runtime streams the frames as they are.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+
+#include "si46xx.h"
+#include "crc32.h"
+#include "si46xx_props.h"
+#include "bundle.h"
+#include "fwinfo.h"
+
+static uint8_t *records;
+static uint32_t records_size;
+static uint32_t records_num;
+
+static void show_help(char *prog_name)
+{
+	printf("usage: %s -m fm|am|dab -o <bundle>\n", prog_name);
+	printf("  -m mode        mode to boot\n");
+	printf("  -o <file>      bundle to write\n");
+	printf("  -p <file>      patch (%spatch.bin)\n", FIRMWARE_PATH);
+	printf("  -f <file>      firmware (%s<mode>.bif)\n", FIRMWARE_PATH);
+	printf("  -c <bytes>     HOST_LOAD data per frame (%d)\n",
+		BUNDLE_CHUNK_DEFAULT);
+	printf("  -s             I2S slave (default master)\n");
+	printf("  -h             this help\n");
+}
+
+static int add_record(uint8_t kind, const void *hdr, int hlen,
+		const void *data, int len)
+{
+	struct bundle_record rec;
+	uint32_t size = sizeof(rec) + BUNDLE_PAD(hlen + len);
+	uint8_t *p;
+
+	p = realloc(records, records_size + size);
+	if (p == NULL)
+		return -ENOMEM;
+	records = p;
+	p += records_size;
+	memset(p, 0, size);
+
+	rec.kind = kind;
+	rec.reserved = 0;
+	rec.len = hlen + len;
+	memcpy(p, &rec, sizeof(rec));
+	memcpy(p + sizeof(rec), hdr, hlen);
+	if (len)
+		memcpy(p + sizeof(rec) + hlen, data, len);
+
+	records_size += size;
+	records_num++;
+	return 0;
+}
+
+static int add_cmd(uint8_t cmd, const uint8_t *args, int len)
+{
+	return add_record(BUNDLE_CMD, &cmd, 1, args, len);
+}
+
+/*
+ * LOAD_INIT and image as HOST_LOAD frames of chunk bytes
+ */
+static int add_image(uint8_t type, const char *path, int chunk)
+{
+	struct bundle_section sec;
+	const char *base = strrchr(path, '/');
+	const char *name = base ? base + 1 : path;
+	uint8_t zero = 0;
+	uint8_t hdr[4] = { SI46XX_HOST_LOAD, 0, 0, 0 };
+	uint8_t *image;
+	uint32_t size;
+	uint32_t pos;
+	int len;
+	int ret;
+
+	/* manifest matches by name, it must not be cut */
+	if (strlen(name) > sizeof(sec.name)) {
+		printf("%s: name longer than %zu characters\n", name,
+			sizeof(sec.name));
+		return -ENAMETOOLONG;
+	}
+	image = fw_file_read(path, &size);
+	if (image == NULL)
+		return -EIO;
+
+	memset(&sec, 0, sizeof(sec));
+	sec.type = type;
+	sec.crc = crc32(0, image, size);
+	memcpy(sec.name, name, strlen(name));
+
+	ret = add_record(BUNDLE_SECTION, &sec, sizeof(sec), NULL, 0);
+	if (ret == 0)
+		ret = add_cmd(SI46XX_LOAD_INIT, &zero, 1);
+	for (pos = 0; (pos < size) && (ret == 0); pos += len) {
+		len = (size - pos > (uint32_t)chunk) ? chunk : size - pos;
+		ret = add_record(BUNDLE_LOAD, hdr, sizeof(hdr),
+			image + pos, len);
+	}
+	printf("%s: %u bytes, %u frames, crc 0x%08x\n", name, size,
+		(size + chunk - 1) / chunk, sec.crc);
+	free(image);
+	return ret;
+}
+
+static int add_props(int mode, bool i2s_master)
+{
+	struct bundle_section sec;
+	const struct si46xx_prop_value *props;
+	uint8_t args[5];
+	uint16_t value;
+	int num;
+	int ret;
+	int i;
+
+	memset(&sec, 0, sizeof(sec));
+	sec.type = BUNDLE_SEC_PROPS;
+	strncpy(sec.name, "properties", sizeof(sec.name));
+	ret = add_record(BUNDLE_SECTION, &sec, sizeof(sec), NULL, 0);
+
+	num = si46xx_init_props(mode, &props);
+	for (i = 0; (i < num) && (ret == 0); i++) {
+		value = props[i].value;
+		if ((props[i].id == SI46XX_DIGITAL_IO_OUTPUT_SELECT) &&
+		    (!i2s_master))
+			value = 0;
+		args[0] = 0;
+		args[1] = props[i].id & 0xFF;
+		args[2] = (props[i].id >> 8) & 0xFF;
+		args[3] = value & 0xFF;
+		args[4] = (value >> 8) & 0xFF;
+		ret = add_cmd(SI46XX_SET_PROPERTY, args, sizeof(args));
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct bundle_header hdr;
+	const char *mode_name = NULL;
+	char *patch = FIRMWARE_PATH "patch.bin";
+	char *firmware = NULL;
+	char *output = NULL;
+	char path[256];
+	bool i2s_master = true;
+	uint32_t settle = SI46XX_PATCH_SETTLE_US;
+	uint8_t zero = 0;
+	int chunk = BUNDLE_CHUNK_DEFAULT;
+	int mode = SI46XX_MODE_UNK;
+	FILE *fp;
+	int ret;
+	int c;
+
+	while ((c = getopt(argc, argv, "m:o:p:f:c:sh")) != -1) {
+		switch (c) {
+		case 'm':
+			mode_name = optarg;
+			if (strcmp(optarg, "fm") == 0)
+				mode = SI46XX_MODE_FM;
+			else if (strcmp(optarg, "am") == 0)
+				mode = SI46XX_MODE_AM;
+			else if (strcmp(optarg, "dab") == 0)
+				mode = SI46XX_MODE_DAB;
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'p':
+			patch = optarg;
+			break;
+		case 'f':
+			firmware = optarg;
+			break;
+		case 'c':
+			chunk = atoi(optarg);
+			break;
+		case 's':
+			i2s_master = false;
+			break;
+		case 'h':
+		default:
+			show_help(argv[0]);
+			return 0;
+		}
+	}
+
+	if ((mode == SI46XX_MODE_UNK) || (output == NULL)) {
+		show_help(argv[0]);
+		return -EINVAL;
+	}
+	if ((chunk <= 0) || (chunk > BUNDLE_CHUNK_MAX)) {
+		printf("Invalid chunk size %d\n", chunk);
+		return -EINVAL;
+	}
+	if (firmware == NULL) {
+		snprintf(path, sizeof(path), "%s%s.bif", FIRMWARE_PATH,
+			mode_name);
+		firmware = path;
+	}
+
+	ret = add_image(BUNDLE_SEC_PATCH, patch, chunk);
+	if (ret == 0)
+		ret = add_record(BUNDLE_WAIT, &settle, sizeof(settle),
+			NULL, 0);
+	if (ret == 0)
+		ret = add_image(BUNDLE_SEC_IMAGE, firmware, chunk);
+	if (ret == 0)
+		ret = add_cmd(SI46XX_BOOT, &zero, 1);
+	if (ret == 0)
+		ret = add_props(mode, i2s_master);
+	if (ret) {
+		printf("Bundle build failed: %d\n", ret);
+		return ret;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, BUNDLE_MAGIC, sizeof(hdr.magic));
+	hdr.version = BUNDLE_VERSION;
+	hdr.mode = mode;
+	hdr.chunk = chunk;
+	hdr.records = records_num;
+	hdr.size = records_size;
+	hdr.crc = crc32(0, records, records_size);
+
+	fp = fopen(output, "wb");
+	if (fp == NULL) {
+		printf("Can not write %s: %s\n", output, strerror(errno));
+		return -errno;
+	}
+	if ((fwrite(&hdr, sizeof(hdr), 1, fp) != 1) ||
+	    (fwrite(records, records_size, 1, fp) != 1)) {
+		printf("Can not write %s: %s\n", output, strerror(errno));
+		fclose(fp);
+		return -EIO;
+	}
+	fclose(fp);
+	printf("%s: %s, %u records, %zu bytes\n", output, mode_name,
+		records_num, sizeof(hdr) + records_size);
+	free(records);
+
+	return 0;
+}
@@ -29,10 +29,20 @@
 #include <getopt.h>
 #include <errno.h>
 #include "si46xx.h"
+#include "si46xx_props.h"
+#include "trace.h"
+#include "prof.h"
+#include "wait.h"
 #include "version.h"
 
 int verbose = 0;
 int i2s_master = 1;
+/* boot bundle from si_bundle, instead of firmware files */
+static const char *bundle;
+/* only what audio needs until first tune */
+static bool fast_boot;
+/* boot from flash or file, whichever is current and faster */
+static bool auto_boot;
 
 #define ARRAY_SIZE(x) (sizeof(x)/sizeof((x)[0]))
 
@@ -101,115 +111,77 @@ uint32_t frequency_list_ch[] = {	CHAN_12A,
 					CHAN_9D,
 					CHAN_8B};
 
-int init_am(int offset)
+/* which of the post boot properties to set */
+#define PROPS_ALL		0
+#define PROPS_AUDIO		1	/* needed for audio */
+#define PROPS_DEFERRED		2	/* set after first tune in fast boot */
+
+/*
+ * Properties set after boot, DIGITAL_IO_OUTPUT_SELECT of the tables is
+ * for I2S master
+ */
+static void set_init_props(int mode, int which)
+{
+	const struct si46xx_prop_value *props;
+	uint16_t value;
+	int num;
+	int i;
+
+	num = si46xx_init_props(mode, &props);
+	for (i = 0; i < num; i++) {
+		if (((which == PROPS_AUDIO) && (props[i].deferred)) ||
+		    ((which == PROPS_DEFERRED) && (!props[i].deferred)))
+			continue;
+		value = props[i].value;
+		if ((props[i].id == SI46XX_DIGITAL_IO_OUTPUT_SELECT) &&
+		    (!i2s_master))
+			value = 0;
+		si46xx_set_property(props[i].id, value);
+	}
+}
+
+/*
+ * Boot mode from bundle, flash offset or firmware files. Bundles carry
+ * their properties.
+ */
+static int boot_mode(int mode, int offset)
 {
 	int ret;
 
+	if (bundle)
+		return si46xx_init_bundle(bundle, mode);
+
+	if (auto_boot)
+		offset = si46xx_boot_select(mode);
 	if (offset > 0)
 		ret = si46xx_boot_flash(offset);
 	else
-		ret = si46xx_init_mode(SI46XX_MODE_AM);
-
+		ret = si46xx_init_mode(mode);
 	if (ret)
 		return ret;
-	/*
-	 * enable I2S output
-	 */
-	si46xx_set_property(SI46XX_PIN_CONFIG_ENABLE, 0x0003);
-
-	si46xx_set_property(SI46XX_AM_SEEK_FREQUENCY_SPACING, 1);
-	si46xx_set_property(SI46XX_AM_SEEK_BAND_BOTTOM, 500);
-	si46xx_set_property(SI46XX_AM_SEEK_BAND_TOP, 1700);
-	si46xx_set_property(SI46XX_AM_VALID_RSSI_THRESHOLD, 15);
-	si46xx_set_property(SI46XX_AM_VALID_SNR_THRESHOLD, 2);
-	/*
-	 * rate
-	 */
-	//si46xx_set_property(SI46XX_DIGITAL_IO_OUTPUT_SAMPLE_RATE, 48000);
-	/*
-	 * master or slave mode
-	 */
-	if (i2s_master)
-		si46xx_set_property(SI46XX_DIGITAL_IO_OUTPUT_SELECT, 0x8000);
-	else
-		si46xx_set_property(SI46XX_DIGITAL_IO_OUTPUT_SELECT, 0x0);
-	/*
-	 * sample size = 16
-	 * slot size = 32
-	 */
-	si46xx_set_property(SI46XX_DIGITAL_IO_OUTPUT_FORMAT,
-		(16 << 8) |	//sample size 16
-		(4 << 4) |	//slot size 16
-		(0 << 0));	//right_j mode
 
+	set_init_props(mode, fast_boot ? PROPS_AUDIO : PROPS_ALL);
 	return 0;
 }
 
-int init_fm(int offset)
+int init_am(int offset)
 {
-	int ret;
-
-	if (offset > 0)
-		ret = si46xx_boot_flash(offset);
-	else
-		ret = si46xx_init_mode(SI46XX_MODE_FM);
-
-	if (ret)
-		return ret;
-	/*
-	 * enable I2S output
-	 */
-	si46xx_set_property(SI46XX_PIN_CONFIG_ENABLE, 0x0003);
-	//si46xx_set_property(SI46XX_FM_VALID_RSSI_THRESHOLD,0x0000);
-	//si46xx_set_property(SI46XX_FM_VALID_SNR_THRESHOLD,0x0000);
-	si46xx_set_property(SI46XX_FM_SOFTMUTE_SNR_LIMITS, 0x0000); // set the SNR limits for soft mute attenuation
-	si46xx_set_property(SI46XX_FM_TUNE_FE_CFG, 0x0000); // front end switch open
-	si46xx_set_property(SI46XX_FM_SEEK_BAND_BOTTOM, 88000 / 10);
-	si46xx_set_property(SI46XX_FM_SEEK_BAND_TOP, 108000 / 10);
-	/*
-	 * rate
-	 */
-	//si46xx_set_property(SI46XX_DIGITAL_IO_OUTPUT_SAMPLE_RATE, 48000);
-	/*
-	 * master or slave mode
-	 */
-	if (i2s_master)
-		si46xx_set_property(SI46XX_DIGITAL_IO_OUTPUT_SELECT, 0x8000);
-	else
-		si46xx_set_property(SI46XX_DIGITAL_IO_OUTPUT_SELECT, 0x0);
-	/*
-	 * sample size = 16
-	 * slot size = 32
-	 */
-	si46xx_set_property(SI46XX_DIGITAL_IO_OUTPUT_FORMAT,
-		(16 << 8) |	//sample size 16
-		(4 << 4) |	//slot size 16
-		(0 << 0));	//right_j mode
-	si46xx_set_property(SI46XX_FM_RDS_CONFIG, 0x0001); // enable RDS
-	si46xx_set_property(SI46XX_FM_AUDIO_DE_EMPHASIS, SI46XX_AUDIO_DE_EMPHASIS_EU); // set de-emphasis for Europe
+	return boot_mode(SI46XX_MODE_AM, offset);
+}
 
-	return 0;
+int init_fm(int offset)
+{
+	return boot_mode(SI46XX_MODE_FM, offset);
 }
+
 int init_dab(int offset)
 {
 	int ret;
 
-	if (offset > 0)
-		ret = si46xx_boot_flash(offset);
-	else
-		ret = si46xx_init_mode(SI46XX_MODE_DAB);
-
+	ret = boot_mode(SI46XX_MODE_DAB, offset);
 	if (ret)
 		return ret;
 	si46xx_dab_set_freq_list(ARRAY_SIZE(frequency_list_nrw),frequency_list_nrw);
-	si46xx_set_property(SI46XX_DAB_CTRL_DAB_MUTE_SIGNAL_LEVEL_THRESHOLD,0);
-	si46xx_set_property(SI46XX_DAB_CTRL_DAB_MUTE_SIGLOW_THRESHOLD,0);
-	si46xx_set_property(SI46XX_DAB_CTRL_DAB_MUTE_ENABLE,0);
-	si46xx_set_property(SI46XX_DIGITAL_SERVICE_INT_SOURCE,1); // enable DSRVPAKTINT interrupt ??
-	si46xx_set_property(SI46XX_DAB_TUNE_FE_CFG,0x0001); // front end switch closed
-	si46xx_set_property(SI46XX_DAB_TUNE_FE_VARM,0x1710); // Front End Varactor configuration (Changed from '10' to 0x1710 to improve receiver sensitivity - Bjoern 27.11.14)
-	si46xx_set_property(SI46XX_DAB_TUNE_FE_VARB,0x1711); // Front End Varactor configuration (Changed from '10' to 0x1711 to improve receiver sensitivity - Bjoern 27.11.14)
-	si46xx_set_property(SI46XX_PIN_CONFIG_ENABLE,0x0003); // enable I2S output
 	return si46xx_dab_tune_freq(0,0);
 }
 
@@ -233,13 +205,27 @@ int init_dab(int offset)
 //};
 //
 
+/* long only options */
+#define OPT_PROFILE_BOOT	0x100
+#define OPT_FAST_BOOT		0x101
+
+static const struct option long_options[] = {
+	{ "profile-boot",	optional_argument,	NULL, OPT_PROFILE_BOOT },
+	{ "fast-boot",		no_argument,		NULL, OPT_FAST_BOOT },
+	{ NULL,			0,			NULL, 0 },
+};
+
 int output_help(char *prog_name)
 {
 	printf("usage: %s -a/b [am|fm|dab]\n",prog_name);
 	printf("Init:\n");
 	printf("  -a             init AM/FM/DAB mode (firmware from file)\n");
-	printf("  -b             boot AM/FM/DAB image from flash\n");
+	printf("  -b             boot patch and AM/FM/DAB image from flash\n");
+	printf("  -t             boot AM/FM/DAB from flash or file, the faster\n");
 	printf("  -s             get sys state (fm, dab, am...)\n");
+	printf("  -r chip:line   wait on INTB gpio line (gpiochip0:12)\n");
+	printf("  -u bundle      with -a: boot from bundle (si_bundle)\n");
+	printf("  -p             probe max SPI clock, save profile\n");
 	printf("Common AM/FM:\n");
 	printf("  -c frequency   FM/AM tune KHz frequency\n");
 	printf("  -l up|down     FM/AM seek next station\n");
@@ -275,6 +261,8 @@ int output_help(char *prog_name)
 	printf("  -o             dab get subchannel info\n");
 	printf("  -v(vvv)        verbose\n");
 	printf("  -h             this help\n");
+	printf("  --profile-boot[=csv]  time boot phases, append to csv\n");
+	printf("  --fast-boot    tune first, rest of init after it\n");
 	if (verbose)
 		printf("\nsi_ctl version %s\n", GIT_VERSION);
 
@@ -362,6 +350,8 @@ int main(int argc, char **argv)
 	bool rds_status = false;
 	bool sys_status = false;
 	bool show_help = false;
+	bool spi_probe = false;
+	uint64_t start = wait_now();
 
 	if (argc == 1)
 		return output_help(argv[0]);
@@ -374,12 +364,15 @@ int main(int argc, char **argv)
 
 	optind = 0;
 	while (optind < argc) {
-		if ((c = getopt(argc, argv, "a:b:c:def:ghi:j:k:l:mnosv")) != -1) {
+		if ((c = getopt_long(argc, argv, "a:b:c:def:ghi:j:k:l:mnopr:st:u:v",
+				long_options, NULL)) != -1) {
 			switch(c){
 			/* init */
 			case 'a':
 			case 'b':
+			case 't':
 				init = true;
+				auto_boot = c == 't';
 				if (strcmp(optarg, "dab") == 0) {
 					mode = SI46XX_MODE_DAB;
 					if (c == 'b')
@@ -400,13 +393,36 @@ int main(int argc, char **argv)
 			/* common for all modes */
 			case 'v':
 				verbose++;
+				/* -vvv dumps bus trace */
+				if (verbose > 2)
+					trace_dump_at_exit();
 				break;
 			case 'h':
 				show_help = true;
 				break;
+			case OPT_PROFILE_BOOT:
+				prof_enable(argv[0], optarg);
+				break;
+			case OPT_FAST_BOOT:
+				fast_boot = true;
+				si46xx_set_fast_boot(1);
+				break;
+			case 'p':
+				spi_probe = true;
+				break;
+			case 'u':
+				bundle = optarg;
+				break;
 			case 's':
 				sys_status = true;
 				break;
+			case 'r':
+				ret = si46xx_intb_init(optarg);
+				if (ret) {
+					printf("INTB setup failed: %d\n", ret);
+					return ret;
+				}
+				break;
 			case 'd':
 				rsq_status = true;
 				break;
@@ -494,6 +510,15 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/* SPI clock probe, in current chip phase */
+	if (spi_probe) {
+		ret = si46xx_spi_probe();
+		if (ret) {
+			printf("SPI probe failed: %d\n", ret);
+			return ret;
+		}
+	}
+
 	/* Get current mode */
 	mode = si46xx_get_sys_mode();
 	if (mode < 0)
@@ -518,6 +543,15 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/* fast boot: audio is up, now the rest of init */
+	if ((init) && (fast_boot)) {
+		printf("Time to tune: %.3f ms\n", (wait_now() - start) / 1000.0);
+		set_init_props(mode, PROPS_DEFERRED);
+		ret = si46xx_boot_info();
+		if (ret)
+			return ret;
+	}
+
 	/* Seek */
 	if ((seek_up) || (seek_down)) {
 		if (!mode_booted(mode)){
@@ -22,22 +22,380 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <stdbool.h>
 #include <errno.h>
 #include "si46xx.h"
+#include "crc32.h"
+#include "trace.h"
+#include "prof.h"
+#include "wait.h"
+#include "fwinfo.h"
 #include "si46xx_props.h"
 #include "version.h"
 
-extern uint32_t crc32(uint32_t crc, const void *buf, size_t size);
-
 int verbose = 0;
 
 #define ARRAY_SIZE(x) (sizeof(x)/sizeof((x)[0]))
 
-#define FLASH_WRITE_BLOCK_SIZE	2048
+/* long only options */
+#define OPT_PROFILE_BOOT	0x100
+#define OPT_CRC_BENCH		0x101
+#define OPT_DELTA		0x102
+#define OPT_FULL		0x103
+
+static const struct option long_options[] = {
+	{ "profile-boot",	optional_argument,	NULL, OPT_PROFILE_BOOT },
+	{ "crc-bench",		no_argument,		NULL, OPT_CRC_BENCH },
+	{ "delta",		no_argument,		NULL, OPT_DELTA },
+	{ "full",		no_argument,		NULL, OPT_FULL },
+	{ NULL,			0,			NULL, 0 },
+};
+
+/* blocks at offset written last time and now */
+static struct fw_blocks old_blocks;
+static struct fw_blocks new_blocks;
+
+/* block differs from the one written there last time */
+static bool block_changed(int i)
+{
+	if ((i >= old_blocks.num) ||
+	    (fw_blocks_len(&old_blocks, i) != fw_blocks_len(&new_blocks, i)))
+		return true;
+	return old_blocks.crcs[i] != new_blocks.crcs[i];
+}
+
+/* sector holds a changed block, or delta is not known */
+static bool sector_dirty(int sector, int offset, long size, bool delta)
+{
+	int pos = sector < offset ? 0 : sector - offset;
+	int end = sector + FLASH_SECTOR_SIZE - offset;
+	int i;
+
+	if (!delta)
+		return true;
+	if (end > size)
+		end = size;
+	for (i = pos / FLASH_DELTA_BLOCK_SIZE;
+	     i * FLASH_DELTA_BLOCK_SIZE < end; i++)
+		if (block_changed(i))
+			return true;
+	return false;
+}
+
+/*
+ * Write block size. Unless known for this board, candidates are timed
+ * on the first blocks written, each FLASH_TUNE_ROUNDS times, and the
+ * fastest per byte is kept in the SPI profile.
+ */
+#define FLASH_TUNE_ROUNDS	4
+
+static const int block_sizes[] = { 1024, 2048, 3072, 4096 };
+static int block_size;
+static int tune_idx;
+static int tune_rounds;
+static uint64_t tune_us[ARRAY_SIZE(block_sizes)];
+static int tune_bytes[ARRAY_SIZE(block_sizes)];
+
+static int block_size_of(unsigned int idx)
+{
+	int max = si46xx_flash_block_max();
+
+	return block_sizes[idx] < max ? block_sizes[idx] : max;
+}
+
+static void block_tune_start(void)
+{
+	block_size = si46xx_flash_block_get();
+	tune_idx = block_size ? -1 : 0;
+	tune_rounds = 0;
+	memset(tune_us, 0, sizeof(tune_us));
+	memset(tune_bytes, 0, sizeof(tune_bytes));
+	if (block_size)
+		printf("Write block %d bytes\n", block_size);
+}
+
+static int block_next(void)
+{
+	return tune_idx < 0 ? block_size : block_size_of(tune_idx);
+}
+
+static void block_done(int len, uint64_t us)
+{
+	unsigned int best = 0;
+	unsigned int i;
+
+	/* short tail blocks say little */
+	if ((tune_idx < 0) || (len != block_size_of(tune_idx)))
+		return;
+	tune_us[tune_idx] += us;
+	tune_bytes[tune_idx] += len;
+	if (++tune_rounds < FLASH_TUNE_ROUNDS)
+		return;
+	tune_rounds = 0;
+	if (++tune_idx < (int)ARRAY_SIZE(block_sizes))
+		return;
+
+	for (i = 0; i < ARRAY_SIZE(block_sizes); i++) {
+		printf("Write block %4d bytes: %.0f KB/s\n", block_size_of(i),
+			tune_bytes[i] * 1000.0 / (tune_us[i] ? tune_us[i] : 1));
+		if (tune_us[i] * tune_bytes[best] < tune_us[best] * tune_bytes[i])
+			best = i;
+	}
+	block_size = block_size_of(best);
+	tune_idx = -1;
+	printf("Write block %d bytes\n", block_size);
+	si46xx_flash_block_set(block_size);
+}
+
+/*
+ * Write image in runs of dirty sectors. Sectors are erased first unless
+ * the whole chip was, only sectors covered by the image are touched.
+ * With try_delta and the blocks written at offset last time known,
+ * sectors whose blocks are all unchanged are skipped. That record is
+ * kept on the host only, the bootloader can not read flash back, so it
+ * is wrong if the flash was written by anything else and delta writes
+ * are opt-in. A run is written in blocks of the write block size,
+ * across sector ends.
+ */
+static int flash_image(int offset, char *buffer, long size, bool erased,
+		bool try_delta)
+{
+	int first = offset & ~(FLASH_SECTOR_SIZE - 1);
+	uint64_t erase_us = 0;
+	uint64_t write_us = 0;
+	uint64_t start;
+	uint32_t crc;
+	int sectors = 0;
+	int written = 0;
+	int skipped = 0;
+	int blocks = 0;
+	int bytes = 0;
+	int sector;
+	int run;
+	int pos;
+	int end;
+	int len;
+	bool delta;
+	int ret;
+
+	ret = fw_blocks_calc(&new_blocks, buffer, size,
+		FLASH_DELTA_BLOCK_SIZE);
+	delta = (try_delta) && (!erased) && (ret == 0) && (first == offset) &&
+		(si46xx_flash_blocks(offset, &old_blocks) == 0) &&
+		(old_blocks.block == new_blocks.block);
+	if (delta)
+		printf("Flash holds image crc 0x%08x, writing changes\n",
+			old_blocks.crc);
+
+	for (sector = first; sector < offset + size; sector = run) {
+		if (!sector_dirty(sector, offset, size, delta)) {
+			skipped++;
+			run = sector + FLASH_SECTOR_SIZE;
+			continue;
+		}
+
+		/* erase run of dirty sectors */
+		for (run = sector; (run < offset + size) &&
+		     (sector_dirty(run, offset, size, delta));
+		     run += FLASH_SECTOR_SIZE) {
+			written++;
+			if (erased)
+				continue;
+			start = wait_now();
+			ret = si46xx_flash_erase_sector(run);
+			erase_us += wait_now() - start;
+			if (ret) {
+				printf("Erase error @0x%08x: %d\n", run, ret);
+				return ret;
+			}
+			sectors++;
+		}
+
+		/* write it */
+		pos = sector < offset ? 0 : sector - offset;
+		end = run - offset < size ? run - offset : size;
+		for (; pos < end; pos += len) {
+			len = block_next();
+			if (len > end - pos)
+				len = end - pos;
+			if (verbose)
+				printf("Writing @0x%08x\n", offset + pos);
+			start = wait_now();
+			crc = crc32(0, buffer + pos, len);
+			ret = si46xx_flash_write(offset + pos, buffer + pos,
+				len, crc + 1, 1);
+			write_us += wait_now() - start;
+			if (ret) {
+				printf("Write error @0x%08x: %d\n",
+					offset + pos, ret);
+				return ret;
+			}
+			block_done(len, wait_now() - start);
+			blocks++;
+			bytes += len;
+		}
+	}
+
+	if (!erased)
+		printf("Erased %d sectors in %.1f ms\n", sectors,
+			erase_us / 1000.0);
+	printf("Wrote %d sectors in %.1f ms, %d unchanged\n", written,
+		write_us / 1000.0, skipped);
+	if (blocks)
+		printf("Wrote %d blocks, %d bytes, %.0f KB/s\n", blocks, bytes,
+			bytes * 1000.0 / (write_us ? write_us : 1));
+	return 0;
+}
+
+/* images to write in this session */
+#define FLASH_IMAGES_MAX	8
+
+struct flash_image {
+	char path[256];
+	int offset;
+	char *buffer;
+	long size;
+};
+
+static struct flash_image images[FLASH_IMAGES_MAX];
+static int images_num;
+
+/*
+ * Read image file, with check_crc its crc32 must be crc
+ */
+static int add_image(const char *path, int offset, uint32_t crc,
+		bool check_crc)
+{
+	struct flash_image *img;
+	uint32_t size;
+
+	if (images_num == FLASH_IMAGES_MAX) {
+		printf("Too many images, max %d\n", FLASH_IMAGES_MAX);
+		return -E2BIG;
+	}
+	img = &images[images_num];
+	snprintf(img->path, sizeof(img->path), "%s", path);
+	img->offset = offset;
+
+	img->buffer = (char *)fw_file_read(path, &size);
+	if (img->buffer == NULL)
+		return -EIO;
+	img->size = size;
+
+	if ((check_crc) && (crc32(0, img->buffer, img->size) != crc)) {
+		printf("%s: crc 0x%08x, expected 0x%08x\n", path,
+			crc32(0, img->buffer, img->size), crc);
+		free(img->buffer);
+		return -EINVAL;
+	}
+
+	images_num++;
+	return 0;
+}
+
+/*
+ * Image list: "<file> <offset> [crc]" per line, hex offset and crc,
+ * files relative to the list
+ */
+static int load_image_list(const char *list)
+{
+	const char *slash = strrchr(list, '/');
+	char line[512];
+	char file[256];
+	char path[256];
+	unsigned int offset;
+	unsigned int crc;
+	FILE *fp;
+	int num;
+	int len;
+	int ret = 0;
+
+	fp = fopen(list, "r");
+	if (fp == NULL) {
+		printf("Can not open %s: %d\n", list, errno);
+		return -errno;
+	}
+	while ((ret == 0) && (fgets(line, sizeof(line), fp))) {
+		num = sscanf(line, "%255s %x %x", file, &offset, &crc);
+		if ((num <= 0) || (file[0] == '#'))
+			continue;
+		if (num < 2) {
+			printf("Invalid line in %s: %s", list, line);
+			ret = -EINVAL;
+			break;
+		}
+		if ((file[0] != '/') && (slash))
+			len = snprintf(path, sizeof(path), "%.*s/%s",
+				(int)(slash - list), list, file);
+		else
+			len = snprintf(path, sizeof(path), "%s", file);
+		if ((len < 0) || (len >= (int)sizeof(path))) {
+			printf("Path too long in %s: %s", list, line);
+			ret = -ENAMETOOLONG;
+			break;
+		}
+		ret = add_image(path, offset, crc, num == 3);
+	}
+	fclose(fp);
+
+	return ret;
+}
+
+static int image_cmp(const void *a, const void *b)
+{
+	return ((const struct flash_image *)a)->offset -
+		((const struct flash_image *)b)->offset;
+}
+
+/*
+ * Write all images back to back in flash order. Images must not share a
+ * sector, erasing one would destroy the other.
+ */
+static int flash_images(bool erased, bool delta)
+{
+	struct flash_image *img;
+	uint64_t start = wait_now();
+	int ret;
+	int i;
+
+	block_tune_start();
+	qsort(images, images_num, sizeof(images[0]), image_cmp);
+	for (i = 1; i < images_num; i++) {
+		img = &images[i - 1];
+		if ((int)((img->offset + img->size - 1) |
+			  (FLASH_SECTOR_SIZE - 1)) >= images[i].offset) {
+			printf("%s and %s share flash sector @0x%08x\n",
+				img->path, images[i].path,
+				images[i].offset & ~(FLASH_SECTOR_SIZE - 1));
+			return -EINVAL;
+		}
+	}
+
+	for (i = 0; i < images_num; i++) {
+		img = &images[i];
+		printf("Flashing %s, %ld bytes @0x%08x\n", img->path,
+			img->size, img->offset);
+		ret = flash_image(img->offset, img->buffer, img->size, erased,
+			delta);
+		if (ret) {
+			/* content there is unknown now */
+			si46xx_flash_forget(img->offset, img->size);
+			return ret;
+		}
+		si46xx_flash_written(img->offset, img->buffer, img->size);
+		free(img->buffer);
+		img->buffer = NULL;
+	}
+	if (images_num > 1)
+		printf("Flashed %d images in %.1f ms\n", images_num,
+			(wait_now() - start) / 1000.0);
+
+	return 0;
+}
 
 void show_help(char *prog_name)
 {
@@ -46,10 +404,18 @@ void show_help(char *prog_name)
 	printf("  -e             erase chip\n");
 	printf("  -w <file>      write file\n");
 	printf("  -o <offset>    offset to read/write\n");
+	printf("  -m <list>      write images of list, lines of\n");
+	printf("                 <file> <offset> [crc], in one session\n");
 	printf("  -d             dump propertyes\n");
 	printf("  -b             boot from flash\n");
 	printf("  -v(vvv)        verbose\n");
 	printf("  -h             this help\n");
+	printf("  --profile-boot[=csv]  time boot phases, append to csv\n");
+	printf("  --delta        with -w/-m: only sectors changed since the\n");
+	printf("                 last write from this host, flash must not\n");
+	printf("                 have been written by anything else since\n");
+	printf("  --full         write all sectors, even with --delta\n");
+	printf("  --crc-bench    check crc32 kernels against table, time them\n");
 	printf(" Standart flash offsets:\n");
 	printf(" 0x%06x          patch 016\n", FLASH_OFFSET_PATCH_016);
 	printf(" 0x%06x          FM firmware\n", FLASH_OFFSET_FM);
@@ -66,8 +432,11 @@ int main(int argc, char **argv)
 	bool erase = false;
 	bool dump = false;
 	bool boot = false;
+	bool delta = false;
+	bool full = false;
 	int offset = -1;
 	char *filename = NULL;
+	char *list = NULL;
 
 	printf("si_flash version %s\n", GIT_VERSION);
 
@@ -81,7 +450,8 @@ int main(int argc, char **argv)
 		goto exit;
 
 	while (optind < argc) {
-		if ((c=getopt(argc, argv, "iew:o:dbv")) != -1) {
+		if ((c = getopt_long(argc, argv, "iew:o:m:dbv",
+				long_options, NULL)) != -1) {
 			switch(c){
 			case 'i':
 				init = true;
@@ -95,6 +465,9 @@ int main(int argc, char **argv)
 			case 'o':
 				offset = strtoul(optarg, NULL, 16);
 				break;
+			case 'm':
+				list = optarg;
+				break;
 			case 'd':
 				dump = true;
 				break;
@@ -103,7 +476,22 @@ int main(int argc, char **argv)
 				break;
 			case 'v':
 				verbose++;
+				/* -vvv dumps bus trace */
+				if (verbose > 2)
+					trace_dump_at_exit();
 				break;
+			case OPT_PROFILE_BOOT:
+				prof_enable(argv[0], optarg);
+				break;
+			case OPT_DELTA:
+				delta = true;
+				break;
+			case OPT_FULL:
+				full = true;
+				break;
+			case OPT_CRC_BENCH:
+				/* no chip needed */
+				return crc32_bench() ? 1 : 0;
 			case 'h':
 			default:
 				show_help(argv[0]);
@@ -116,6 +504,23 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/* images read and checked before the chip is touched */
+	if (filename) {
+		if (offset < 0) {
+			printf("Invalid offset\n");
+			ret = -EINVAL;
+			goto exit;
+		}
+		ret = add_image(filename, offset, 0, false);
+		if (ret)
+			goto exit;
+	}
+	if (list) {
+		ret = load_image_list(list);
+		if (ret)
+			goto exit;
+	}
+
 	/* init */
 	if (init) {
 		mode = si46xx_get_sys_mode();
@@ -178,63 +583,10 @@ int main(int argc, char **argv)
 	}
 
 	/* flash */
-	if (filename) {
-		FILE *f;
-		long size;
-		char *buffer;
-		int i = 0;
-
-		if (offset < 0) {
-			printf("Invalid offset\n");
-			ret = -EINVAL;
-			goto exit;
-		}
-		f = fopen(filename, "rb");
-		if (f == NULL) {
-			printf("File error: %d\n", errno);
-			ret = -EIO;
-			goto exit;
-		}
-
-		/* obtain file size */
-		fseek (f , 0 , SEEK_END);
-		size = ftell (f);
-		rewind (f);
-
-		printf("Flashing %d bytes @0x%08x\n", size, offset);
-
-		buffer = malloc(size);
-		if (buffer == NULL) {
-			printf("Failed to allocate buffer\n");
-			fclose(f);
-			ret = -ENOMEM;
-			goto exit;
-		}
-
-		if (size != fread(buffer, 1, size, f)) {
-			printf("Reading error\n");
-			fclose(f);
-			ret = -EIO;
+	if (images_num) {
+		ret = flash_images(erase, (delta) && (!full));
+		if (ret)
 			goto exit;
-		}
-		fclose(f);
-
-		/* write */
-		while (i < size) {
-			uint32_t crc;
-
-			printf("Writing @0x%08x\n", offset + i);
-			crc = crc32(0, buffer + i, FLASH_WRITE_BLOCK_SIZE);
-			ret = si46xx_flash_write(offset + i, buffer + i,
-				FLASH_WRITE_BLOCK_SIZE, crc + 1, 1);
-			if (ret) {
-				printf("Write error @0x%08x: %d\n", offset, ret);
-				free(buffer);
-				goto exit;
-			}
-			i += FLASH_WRITE_BLOCK_SIZE;
-		}
-		free(buffer);
 	}
 
 	/* boot */
@@ -0,0 +1,192 @@
+/*
+ * si_lz - pack firmware image into compressed container (see fwlz.h) or
+ * unpack one
+ *
+ * si_ctl and si_flash load <image>.lz in place of a missing <image>,
+ * unpacking while sending.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+
+#include "fwlz.h"
+#include "fwinfo.h"
+#include "crc32.h"
+
+static void show_help(char *prog_name)
+{
+	printf("usage: %s [-d] <in> <out>\n", prog_name);
+	printf("  -d             unpack container\n");
+	printf("  -b <bytes>     image bytes per block (%d)\n", FWLZ_BLOCK);
+	printf("  -h             this help\n");
+}
+
+static int pack(const uint8_t *image, uint32_t size, uint32_t block,
+		FILE *fp)
+{
+	struct fwlz_header hdr;
+	struct fwlz_block blk;
+	uint8_t *out;
+	uint32_t packed = sizeof(hdr);
+	uint32_t pos;
+	uint32_t len;
+	int ret;
+
+	out = malloc(block);
+	if (out == NULL)
+		return -ENOMEM;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, FWLZ_MAGIC, sizeof(hdr.magic));
+	hdr.version = FWLZ_VERSION;
+	hdr.size = size;
+	hdr.crc = crc32(0, image, size);
+	hdr.block = block;
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+		goto err;
+
+	for (pos = 0; pos < size; pos += len) {
+		len = size - pos < block ? size - pos : block;
+		blk.crc = crc32(0, image + pos, len);
+		/* must shrink, else stored */
+		ret = fwlz_compress(image + pos, len, out, len - 1);
+		if (ret > 0) {
+			blk.len = ret;
+			if ((fwrite(&blk, sizeof(blk), 1, fp) != 1) ||
+			    (fwrite(out, ret, 1, fp) != 1))
+				goto err;
+		} else {
+			blk.len = len | FWLZ_STORED;
+			if ((fwrite(&blk, sizeof(blk), 1, fp) != 1) ||
+			    (fwrite(image + pos, len, 1, fp) != 1))
+				goto err;
+		}
+		packed += sizeof(blk) + (blk.len & ~FWLZ_STORED);
+	}
+	free(out);
+	printf("%u -> %u bytes (%u%%), %u blocks, crc 0x%08x\n", size, packed,
+		packed * 100 / size, (size + block - 1) / block, hdr.crc);
+	return 0;
+err:
+	free(out);
+	return -EIO;
+}
+
+static int unpack(const uint8_t *data, uint32_t size, FILE *fp)
+{
+	const struct fwlz_header *hdr = (const void *)data;
+	struct fwlz_block blk;
+	uint8_t *out;
+	uint32_t pos = sizeof(*hdr);
+	uint32_t done = 0;
+	uint32_t block;
+	uint32_t len;
+	int ret = 0;
+
+	if ((size < sizeof(*hdr)) || (fwlz_header_check(hdr))) {
+		printf("Not a firmware container\n");
+		return -EINVAL;
+	}
+	out = malloc(FWLZ_BLOCK);
+	if (out == NULL)
+		return -ENOMEM;
+
+	while ((done < hdr->size) && (ret == 0)) {
+		block = hdr->size - done < hdr->block ?
+			hdr->size - done : hdr->block;
+		if (size - pos < sizeof(blk)) {
+			ret = -EINVAL;
+			break;
+		}
+		memcpy(&blk, data + pos, sizeof(blk));
+		pos += sizeof(blk);
+		len = blk.len & ~FWLZ_STORED;
+		if (len > size - pos) {
+			ret = -EINVAL;
+			break;
+		}
+		if (blk.len & FWLZ_STORED) {
+			ret = len == block ? 0 : -EINVAL;
+			if (ret == 0)
+				memcpy(out, data + pos, len);
+		} else {
+			ret = fwlz_decompress(data + pos, len, out, block);
+			ret = (uint32_t)ret == block ? 0 : -EINVAL;
+		}
+		if ((ret == 0) && (crc32(0, out, block) != blk.crc))
+			ret = -EINVAL;
+		if ((ret == 0) && (fwrite(out, block, 1, fp) != 1))
+			ret = -EIO;
+		pos += len;
+		done += block;
+	}
+	free(out);
+	if (ret)
+		printf("Corrupt container @%u\n", done);
+	else
+		printf("%u -> %u bytes\n", size, hdr->size);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	bool decompress = false;
+	uint32_t block = FWLZ_BLOCK;
+	uint32_t size;
+	uint8_t *data;
+	FILE *fp;
+	int ret;
+	int c;
+
+	while ((c = getopt(argc, argv, "db:h")) != -1) {
+		switch (c) {
+		case 'd':
+			decompress = true;
+			break;
+		case 'b':
+			block = atoi(optarg);
+			break;
+		case 'h':
+		default:
+			show_help(argv[0]);
+			return 0;
+		}
+	}
+	if (argc - optind != 2) {
+		show_help(argv[0]);
+		return -EINVAL;
+	}
+	if ((block == 0) || (block > FWLZ_BLOCK)) {
+		printf("Invalid block size %u\n", block);
+		return -EINVAL;
+	}
+
+	data = fw_file_read(argv[optind], &size);
+	if (data == NULL)
+		return -EIO;
+	fp = fopen(argv[optind + 1], "wb");
+	if (fp == NULL) {
+		printf("Can not write %s: %s\n", argv[optind + 1],
+			strerror(errno));
+		free(data);
+		return -errno;
+	}
+
+	if (decompress)
+		ret = unpack(data, size, fp);
+	else
+		ret = pack(data, size, block, fp);
+	if (fclose(fp) && (ret == 0))
+		ret = -EIO;
+	free(data);
+	if (ret) {
+		printf("Failed: %d\n", ret);
+		unlink(argv[optind + 1]);
+	}
+
+	return ret;
+}
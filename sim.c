@@ -0,0 +1,836 @@
+/*
+ * sim - in-process Si46xx model, lets si_ctl/si_flash run without hardware
+ *
+ * Models the part of the command set used by this tool: CTS timing,
+ * POWER_UP/LOAD_INIT/HOST_LOAD/FLASH_LOAD/BOOT, GET_FUNC_INFO (revision
+ * is a hash of the loaded image), properties, FM/AM tune/seek/RSQ, RDS,
+ * DAB frequency list, digrad status, service list and the flash. Every command keeps CTS low for its configured latency
+ * and tune/seek raise STCINT after theirs, so boot, tune and scan timings
+ * can be measured.
+ *
+ * Usage: sim[:key=value,...] in place of the bus device
+ *	file=<path>	keep chip state and flash contents in file, so it
+ *			survives between runs like the real chip
+ *	<latency>=<us>	override latency, see sim_lat[] for names,
+ *			boot= sets all boot_* at once
+ *
+ * Loaded images are identified by a 4 byte tag at their start ("SIFM",
+ * "SIDB", "SIAM"), images loaded from flash without a tag by the
+ * standard FLASH_OFFSET_*. Anything else boots as FM.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "si46xx.h"
+#include "si46xx_props.h"
+#include "sim.h"
+#include "trace.h"
+
+#define SIM_MAGIC		0x53490002	/* SI, state layout 2 */
+#define SIM_FLASH_SIZE		(4 * 1024 * 1024)
+#define SIM_FLASH_SECTOR	4096
+#define SIM_REPLY_MAX		4096
+
+/* PUP_STATE */
+#define SIM_PUP_RESET		0
+#define SIM_PUP_BOOTLOADER	2
+#define SIM_PUP_APP		3
+
+/* GET_SYS_STATE image */
+#define SIM_IMAGE_BOOTLOADER	0
+#define SIM_IMAGE_FM		1
+#define SIM_IMAGE_DAB		2
+#define SIM_IMAGE_AM		5
+
+/* STATUS3 */
+#define SIM_CMDOFERR		(1 << 2)
+
+enum {
+	LAT_CMD,
+	LAT_POWERUP,
+	LAT_LOAD_INIT,
+	LAT_HOST_LOAD,
+	LAT_FLASH_LOAD,
+	LAT_BOOT_FM,
+	LAT_BOOT_DAB,
+	LAT_BOOT_AM,
+	LAT_TUNE,
+	LAT_SEEK,
+	LAT_DAB_TUNE,
+	LAT_SERVICE_LIST,
+	LAT_FLASH_WRITE,
+	LAT_FLASH_PAGE,
+	LAT_FLASH_ERASE,
+	LAT_FLASH_ERASE_CHIP,
+	LAT_NUM
+};
+
+/* latencies, us */
+static struct {
+	const char *name;
+	int us;
+} sim_lat[LAT_NUM] = {
+	[LAT_CMD]		= { "cmd",		20 },
+	[LAT_POWERUP]		= { "powerup",		20 },
+	[LAT_LOAD_INIT]		= { "load_init",	4000 },
+	[LAT_HOST_LOAD]		= { "host_load",	0 },
+	[LAT_FLASH_LOAD]	= { "flash_load",	300000 },
+	[LAT_BOOT_FM]		= { "boot_fm",		63000 },
+	[LAT_BOOT_DAB]		= { "boot_dab",		198000 },
+	[LAT_BOOT_AM]		= { "boot_am",		63000 },
+	[LAT_TUNE]		= { "tune",		50000 },
+	[LAT_SEEK]		= { "seek",		1000 },	/* per channel */
+	[LAT_DAB_TUNE]		= { "dab_tune",		150000 },
+	[LAT_SERVICE_LIST]	= { "service_list",	1000 },
+	[LAT_FLASH_WRITE]	= { "flash_write",	480 },
+	[LAT_FLASH_PAGE]	= { "flash_page",	190 },	/* per 256 bytes */
+	[LAT_FLASH_ERASE]	= { "flash_erase",	45000 },
+	[LAT_FLASH_ERASE_CHIP]	= { "flash_erase_chip",	2000000 },
+};
+
+/* FM stations, 10 kHz */
+static const uint16_t sim_fm_stations[] = { 8930, 9470, 10050, 10550, 10720 };
+/* AM stations, kHz */
+static const uint16_t sim_am_stations[] = { 531, 594, 693, 1017, 1422 };
+
+struct sim_service {
+	uint32_t id;
+	uint16_t comp;
+	const char *label;
+};
+
+static const struct sim_ensemble {
+	uint32_t khz;
+	uint16_t id;
+	const char *label;
+	int num;
+	struct sim_service services[3];
+} sim_ensembles[] = {
+	{ CHAN_5C, 0x10bc, "SIM ENSEMBLE 5C", 3, {
+		{ 0xd210, 1, "SIM RADIO ONE" },
+		{ 0xd220, 2, "SIM RADIO TWO" },
+		{ 0xd230, 3, "SIM NEWS" } } },
+	{ CHAN_11D, 0x11d0, "SIM ENSEMBLE 11D", 2, {
+		{ 0xe110, 4, "SIM CLASSIC" },
+		{ 0xe120, 5, "SIM TRAFFIC" } } },
+};
+
+static const char sim_rds_ps[] = "SIM FM  ";
+static const char sim_rds_rt[] = "Si46xx simulator radiotext\r";
+
+/* chip state, lives in state file if one is given */
+struct sim_chip {
+	uint32_t magic;
+	uint8_t pup;
+	uint8_t image;		/* running image */
+	uint8_t patched;	/* patch loaded */
+	uint8_t loading;	/* LOAD_INIT seen */
+	uint8_t load_image;	/* image being loaded */
+	uint32_t load_size;
+	uint32_t load_sum;	/* hash of image being loaded */
+	uint32_t patch_rev;	/* hash of patch */
+	uint32_t image_rev;	/* hash of running image */
+	uint8_t err;
+	uint8_t status3;
+	uint8_t stcint;
+	uint64_t busy_until;	/* CTS low until */
+	uint64_t stc_at;	/* STCINT raised at */
+	uint16_t freq;
+	uint8_t valid;		/* tuned to station */
+	uint8_t dab_num;
+	uint8_t dab_index;
+	uint32_t dab_freq[48];
+	uint32_t rds_group;
+	uint16_t rds_received;
+	uint16_t props[0x10000];
+	uint16_t reply_len;
+	uint8_t reply[SIM_REPLY_MAX];
+	uint8_t flash[SIM_FLASH_SIZE];
+};
+
+static struct sim_chip *chip;
+
+static uint64_t sim_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint16_t get_u16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_u16(int pos, uint16_t val)
+{
+	chip->reply[pos] = val & 0xff;
+	chip->reply[pos + 1] = (val >> 8) & 0xff;
+}
+
+static void put_u32(int pos, uint32_t val)
+{
+	put_u16(pos, val & 0xffff);
+	put_u16(pos + 2, val >> 16);
+}
+
+/* FNV-1a, stands in for the revision of loaded code */
+static uint32_t sim_hash(uint32_t hash, const uint8_t *data, int len)
+{
+	while (len--)
+		hash = (hash ^ *data++) * 16777619;
+	return hash;
+}
+
+static void sim_reply(int len)
+{
+	chip->reply_len = len;
+}
+
+static int sim_tag_image(const uint8_t *data, int len)
+{
+	if (len < 4)
+		return 0;
+	if (memcmp(data, "SIFM", 4) == 0)
+		return SIM_IMAGE_FM;
+	if (memcmp(data, "SIDB", 4) == 0)
+		return SIM_IMAGE_DAB;
+	if (memcmp(data, "SIAM", 4) == 0)
+		return SIM_IMAGE_AM;
+	return 0;
+}
+
+static void sim_default_props(void)
+{
+	memset(chip->props, 0, sizeof(chip->props));
+	chip->props[FM_SEEK_BAND_BOTTOM] = 8750;
+	chip->props[FM_SEEK_BAND_TOP] = 10790;
+	chip->props[FM_SEEK_FREQUENCY_SPACING] = 10;
+	chip->props[SI46XX_AM_SEEK_BAND_BOTTOM] = 520;
+	chip->props[SI46XX_AM_SEEK_BAND_TOP] = 1710;
+	chip->props[SI46XX_AM_SEEK_FREQUENCY_SPACING] = 9;
+}
+
+static int sim_is_station(uint16_t freq)
+{
+	const uint16_t *list;
+	int num;
+	int i;
+
+	if (chip->image == SIM_IMAGE_AM) {
+		list = sim_am_stations;
+		num = sizeof(sim_am_stations) / sizeof(sim_am_stations[0]);
+	} else {
+		list = sim_fm_stations;
+		num = sizeof(sim_fm_stations) / sizeof(sim_fm_stations[0]);
+	}
+	for (i = 0; i < num; i++)
+		if (list[i] == freq)
+			return 1;
+	return 0;
+}
+
+/* ensemble at current DAB frequency */
+static const struct sim_ensemble *sim_ensemble(void)
+{
+	int i;
+
+	if (chip->dab_index >= chip->dab_num)
+		return NULL;
+	for (i = 0; i < sizeof(sim_ensembles) / sizeof(sim_ensembles[0]); i++)
+		if (sim_ensembles[i].khz == chip->dab_freq[chip->dab_index])
+			return &sim_ensembles[i];
+	return NULL;
+}
+
+/* returns number of channel steps taken */
+static int sim_seek(int up, int wrap)
+{
+	uint16_t bottom, top, spacing;
+	uint16_t freq = chip->freq;
+	int steps = 0;
+
+	if (chip->image == SIM_IMAGE_AM) {
+		bottom = chip->props[SI46XX_AM_SEEK_BAND_BOTTOM];
+		top = chip->props[SI46XX_AM_SEEK_BAND_TOP];
+		spacing = chip->props[SI46XX_AM_SEEK_FREQUENCY_SPACING];
+	} else {
+		bottom = chip->props[FM_SEEK_BAND_BOTTOM];
+		top = chip->props[FM_SEEK_BAND_TOP];
+		spacing = chip->props[FM_SEEK_FREQUENCY_SPACING];
+	}
+	if ((spacing == 0) || (bottom >= top))
+		return 0;
+
+	do {
+		if (up)
+			freq += spacing;
+		else
+			freq -= spacing;
+		if ((freq > top) || (freq < bottom)) {
+			if (!wrap)
+				break;
+			freq = up ? bottom : top;
+		}
+		steps++;
+		if (sim_is_station(freq)) {
+			chip->freq = freq;
+			chip->valid = 1;
+			return steps;
+		}
+	} while ((freq != chip->freq) && (steps < 0x10000));
+
+	chip->valid = 0;
+	return steps;
+}
+
+static void sim_rsq(int am)
+{
+	int8_t rssi = chip->valid ? 45 : 5;
+	int8_t snr = chip->valid ? 25 : 0;
+
+	chip->reply[5] = chip->valid ? 0x01 : 0x00;
+	put_u16(6, chip->freq);
+	chip->reply[8] = 0;
+	chip->reply[9] = rssi;
+	chip->reply[10] = snr;
+	chip->reply[11] = am ? 30 : 0;
+	put_u16(12, 0);
+	chip->reply[15] = 0;
+	sim_reply(am ? 16 : 20);
+}
+
+/* cycle through PS (group 0A) and radiotext (group 2A) */
+static void sim_rds(void)
+{
+	uint16_t blocks[4];
+	uint32_t n = chip->rds_group++;
+	int seg;
+
+	blocks[0] = 0xd3c2;
+	if (n % 2 == 0) {
+		seg = (n / 2) % 4;
+		blocks[1] = (0x0 << 11) | seg;
+		blocks[2] = 0;
+		blocks[3] = (sim_rds_ps[seg * 2] << 8) | sim_rds_ps[seg * 2 + 1];
+	} else {
+		seg = (n / 2) % 16;
+		blocks[1] = (0x4 << 11) | seg;
+		if (seg * 4 < sizeof(sim_rds_rt) - 1) {
+			const char *p = &sim_rds_rt[seg * 4];
+			int len = sizeof(sim_rds_rt) - 1 - seg * 4;
+
+			blocks[2] = (p[0] << 8) | (len > 1 ? p[1] : ' ');
+			blocks[3] = ((len > 2 ? p[2] : ' ') << 8) |
+				(len > 3 ? p[3] : ' ');
+		} else {
+			blocks[2] = 0x2020;
+			blocks[3] = 0x2020;
+		}
+	}
+	chip->rds_received += 4;
+
+	chip->reply[5] = 0x02;	/* RDSSYNC */
+	chip->reply[10] = 1;	/* RDSFIFOUSED */
+	put_u16(12, blocks[0]);
+	put_u16(14, blocks[1]);
+	put_u16(16, blocks[2]);
+	put_u16(18, blocks[3]);
+	sim_reply(20);
+}
+
+static void sim_service_list(void)
+{
+	const struct sim_ensemble *ens = sim_ensemble();
+	int pos = 12;
+	int i;
+
+	if ((!ens) || (!chip->valid)) {
+		sim_reply(6);
+		return;
+	}
+	for (i = 0; i < ens->num; i++) {
+		put_u32(pos, ens->services[i].id);
+		chip->reply[pos + 4] = 0;
+		chip->reply[pos + 5] = 1;	/* one component */
+		chip->reply[pos + 6] = 0;
+		memset(&chip->reply[pos + 8], ' ', 16);
+		memcpy(&chip->reply[pos + 8], ens->services[i].label,
+			strlen(ens->services[i].label));
+		put_u16(pos + 24, ens->services[i].comp);
+		pos += 28;
+	}
+	put_u16(4, pos - 6);
+	put_u16(6, 1);
+	chip->reply[8] = ens->num;
+	sim_reply(pos);
+}
+
+static int sim_flash_load(const uint8_t *arg, int len)
+{
+	uint32_t addr;
+	uint32_t size;
+	uint32_t i;
+
+	if (chip->pup != SIM_PUP_BOOTLOADER)
+		return -1;
+
+	switch (arg[0]) {
+	case 0x00:	/* load image */
+		if ((!chip->loading) || (len < 7))
+			return -1;
+		addr = get_u32(&arg[3]);
+		if (addr >= SIM_FLASH_SIZE)
+			return -1;
+		chip->load_image = sim_tag_image(&chip->flash[addr],
+			SIM_FLASH_SIZE - addr);
+		if (!chip->load_image) {
+			if (addr == FLASH_OFFSET_DAB)
+				chip->load_image = SIM_IMAGE_DAB;
+			else if (addr == FLASH_OFFSET_AM)
+				chip->load_image = SIM_IMAGE_AM;
+			else if (addr == FLASH_OFFSET_FM)
+				chip->load_image = SIM_IMAGE_FM;
+		}
+		chip->load_size = 1;
+		chip->load_sum = sim_hash(2166136261U, &chip->flash[addr],
+			SIM_FLASH_SECTOR < SIM_FLASH_SIZE - addr ?
+			SIM_FLASH_SECTOR : SIM_FLASH_SIZE - addr);
+		return sim_lat[LAT_FLASH_LOAD].us;
+	case 0x11:	/* get property */
+		if (len < 3)
+			return -1;
+		put_u16(4, get_u16(&arg[1]) == BL_SPI_CLOCK_FREQ_KHZ ?
+			10000 : 0);
+		sim_reply(6);
+		return sim_lat[LAT_CMD].us;
+	case 0x10:	/* set property */
+		return sim_lat[LAT_CMD].us;
+	case 0xFF:	/* erase chip */
+		memset(chip->flash, 0xff, SIM_FLASH_SIZE);
+		return sim_lat[LAT_FLASH_ERASE_CHIP].us;
+	case 0xFE:	/* erase sector */
+		if (len < 7)
+			return -1;
+		addr = get_u32(&arg[3]) & ~(SIM_FLASH_SECTOR - 1);
+		if (addr >= SIM_FLASH_SIZE)
+			return -1;
+		memset(&chip->flash[addr], 0xff, SIM_FLASH_SECTOR);
+		return sim_lat[LAT_FLASH_ERASE].us;
+	case 0xF0:	/* write */
+	case 0xF1:	/* write and verify */
+		if (len < 15)
+			return -1;
+		addr = get_u32(&arg[7]);
+		size = get_u32(&arg[11]);
+		if ((len < 15 + size) || (addr + size > SIM_FLASH_SIZE))
+			return -1;
+		/* NOR flash, programming only clears bits */
+		for (i = 0; i < size; i++)
+			chip->flash[addr + i] &= arg[15 + i];
+		return sim_lat[LAT_FLASH_WRITE].us +
+			(size + 255) / 256 * sim_lat[LAT_FLASH_PAGE].us;
+	}
+	return -1;
+}
+
+/* execute command, returns CTS latency or -1 on ERR_CMD */
+static int sim_exec(uint8_t cmd, const uint8_t *arg, int len)
+{
+	uint64_t now = sim_now();
+	const struct sim_ensemble *ens;
+	int steps;
+	int i;
+
+	/* nothing but POWER_UP is accepted out of reset */
+	if ((chip->pup == SIM_PUP_RESET) && (cmd != SI46XX_POWER_UP)) {
+		memset(&chip->reply[4], 0xff, SIM_REPLY_MAX - 4);
+		sim_reply(SIM_REPLY_MAX);
+		return sim_lat[LAT_CMD].us;
+	}
+
+	switch (cmd) {
+	case SI46XX_POWER_UP:
+		if (chip->pup != SIM_PUP_RESET)
+			return -1;
+		chip->pup = SIM_PUP_BOOTLOADER;
+		chip->image = SIM_IMAGE_BOOTLOADER;
+		chip->patched = 0;
+		chip->loading = 0;
+		return sim_lat[LAT_POWERUP].us;
+	case SI46XX_LOAD_INIT:
+		if (chip->pup != SIM_PUP_BOOTLOADER)
+			return -1;
+		/* first image loaded is the patch */
+		if ((chip->loading) && (chip->load_size) && (!chip->patched)) {
+			chip->patched = 1;
+			chip->patch_rev = chip->load_sum;
+		}
+		chip->loading = 1;
+		chip->load_size = 0;
+		chip->load_image = 0;
+		chip->load_sum = 2166136261U;
+		return sim_lat[LAT_LOAD_INIT].us;
+	case SI46XX_HOST_LOAD:
+		if ((chip->pup != SIM_PUP_BOOTLOADER) || (!chip->loading) ||
+		    (len < 3))
+			return -1;
+		if (chip->load_size == 0)
+			chip->load_image = sim_tag_image(arg + 3, len - 3);
+		chip->load_size += len - 3;
+		chip->load_sum = sim_hash(chip->load_sum, arg + 3, len - 3);
+		return sim_lat[LAT_HOST_LOAD].us;
+	case SI46XX_FLASH_LOAD:
+		if (len < 1)
+			return -1;
+		return sim_flash_load(arg, len);
+	case SI46XX_BOOT:
+		if ((chip->pup != SIM_PUP_BOOTLOADER) || (!chip->patched) ||
+		    (!chip->loading) || (!chip->load_size))
+			return -1;
+		chip->pup = SIM_PUP_APP;
+		chip->image = chip->load_image ? chip->load_image : SIM_IMAGE_FM;
+		chip->image_rev = chip->load_sum;
+		chip->loading = 0;
+		chip->stcint = 0;
+		chip->stc_at = 0;
+		chip->valid = 0;
+		chip->dab_num = 0;
+		chip->freq = chip->image == SIM_IMAGE_AM ? 520 : 8750;
+		sim_default_props();
+		if (chip->image == SIM_IMAGE_DAB)
+			return sim_lat[LAT_BOOT_DAB].us;
+		if (chip->image == SIM_IMAGE_AM)
+			return sim_lat[LAT_BOOT_AM].us;
+		return sim_lat[LAT_BOOT_FM].us;
+	case SI46XX_GET_PART_INFO:
+		chip->reply[4] = 0x02;	/* CHIPREV */
+		chip->reply[5] = 0x00;	/* ROMID */
+		put_u16(8, 4688);
+		sim_reply(22);
+		return sim_lat[LAT_CMD].us;
+	case SI46XX_GET_FUNC_INFO:
+		/* REVEXT, REVBRANCH, REVINT, flags, SVN id */
+		memset(&chip->reply[4], 0, 8);
+		if (chip->pup == SIM_PUP_APP) {
+			chip->reply[4] = 5;
+			chip->reply[6] = chip->image;
+			put_u32(8, chip->image_rev);
+		} else if (chip->patched) {
+			chip->reply[4] = 1;
+			put_u32(8, chip->patch_rev);
+		} else if ((chip->loading) && (chip->load_size)) {
+			/* patch loaded, not yet followed by LOAD_INIT */
+			chip->reply[4] = 1;
+			put_u32(8, chip->load_sum);
+		}
+		sim_reply(12);
+		return sim_lat[LAT_CMD].us;
+	case SI46XX_GET_SYS_STATE:
+		chip->reply[4] = chip->pup == SIM_PUP_APP ?
+			chip->image : SIM_IMAGE_BOOTLOADER;
+		sim_reply(6);
+		return sim_lat[LAT_CMD].us;
+	}
+
+	/* application commands */
+	if (chip->pup != SIM_PUP_APP)
+		return -1;
+
+	switch (cmd) {
+	case SI46XX_SET_PROPERTY:
+		if (len < 5)
+			return -1;
+		chip->props[get_u16(&arg[1])] = get_u16(&arg[3]);
+		return sim_lat[LAT_CMD].us;
+	case SI46XX_GET_PROPERTY:
+		if (len < 3)
+			return -1;
+		put_u16(4, chip->props[get_u16(&arg[1])]);
+		sim_reply(6);
+		return sim_lat[LAT_CMD].us;
+	}
+
+	if ((chip->image == SIM_IMAGE_FM) || (chip->image == SIM_IMAGE_AM)) {
+		int am = chip->image == SIM_IMAGE_AM;
+
+		switch (cmd) {
+		case SI46XX_FM_TUNE_FREQ:
+		case SI46XX_AM_TUNE_FREQ:
+			if ((len < 3) || (am != (cmd == SI46XX_AM_TUNE_FREQ)))
+				return -1;
+			chip->freq = get_u16(&arg[1]);
+			chip->valid = sim_is_station(chip->freq);
+			chip->rds_group = 0;
+			chip->stcint = 0;
+			chip->stc_at = now + sim_lat[LAT_TUNE].us;
+			return sim_lat[LAT_CMD].us;
+		case SI46XX_FM_SEEK_START:
+		case SI46XX_AM_SEEK_START:
+			if ((len < 2) || (am != (cmd == SI46XX_AM_SEEK_START)))
+				return -1;
+			steps = sim_seek(arg[1] & 0x02, arg[1] & 0x01);
+			chip->rds_group = 0;
+			chip->stcint = 0;
+			chip->stc_at = now + steps * sim_lat[LAT_SEEK].us +
+				sim_lat[LAT_TUNE].us;
+			return sim_lat[LAT_CMD].us;
+		case SI46XX_FM_RSQ_STATUS:
+		case SI46XX_AM_RSQ_STATUS:
+			if ((len >= 1) && (arg[0] & 0x01))
+				chip->stcint = 0;
+			sim_rsq(am);
+			return sim_lat[LAT_CMD].us;
+		}
+	}
+
+	if (chip->image == SIM_IMAGE_FM) {
+		switch (cmd) {
+		case SI46XX_FM_RDS_STATUS:
+			if (chip->valid)
+				sim_rds();
+			else
+				sim_reply(20);
+			return sim_lat[LAT_CMD].us;
+		case SI46XX_FM_RDS_BLOCKCOUNT:
+			put_u16(4, chip->rds_received);
+			put_u16(6, chip->rds_received);
+			put_u16(8, 0);
+			sim_reply(10);
+			if ((len >= 1) && (arg[0] & 0x01))
+				chip->rds_received = 0;
+			return sim_lat[LAT_CMD].us;
+		}
+	}
+
+	if (chip->image == SIM_IMAGE_DAB) {
+		switch (cmd) {
+		case SI46XX_DAB_SET_FREQ_LIST:
+			if ((len < 3) || (arg[0] == 0) || (arg[0] > 48) ||
+			    (len < 3 + 4 * arg[0]))
+				return -1;
+			chip->dab_num = arg[0];
+			for (i = 0; i < arg[0]; i++)
+				chip->dab_freq[i] = get_u32(&arg[3 + 4 * i]);
+			return sim_lat[LAT_CMD].us;
+		case SI46XX_DAB_TUNE_FREQ:
+			if ((len < 2) || (arg[1] >= chip->dab_num))
+				return -1;
+			chip->dab_index = arg[1];
+			chip->valid = sim_ensemble() != NULL;
+			chip->stcint = 0;
+			chip->stc_at = now + sim_lat[LAT_DAB_TUNE].us;
+			return sim_lat[LAT_CMD].us;
+		case SI46XX_DAB_DIGRAD_STATUS:
+			if ((len >= 1) && (arg[0] & 0x01))
+				chip->stcint = 0;
+			chip->reply[5] = chip->valid ? 0x05 : 0x00;
+			chip->reply[6] = chip->valid ? 40 : 2;
+			chip->reply[7] = chip->valid ? 15 : 0;
+			chip->reply[8] = chip->valid ? 100 : 0;
+			chip->reply[9] = chip->valid ? 20 : 0;
+			put_u32(12, chip->dab_num ?
+				chip->dab_freq[chip->dab_index] : 0);
+			chip->reply[16] = chip->dab_index;
+			sim_reply(22);
+			return sim_lat[LAT_CMD].us;
+		case SI46XX_DAB_GET_DIGITAL_SERVICE_LIST:
+			sim_service_list();
+			return sim_lat[LAT_SERVICE_LIST].us;
+		case SI46XX_DAB_START_DIGITAL_SERVICE:
+			if ((len < 11) || (!chip->valid) ||
+			    (!(ens = sim_ensemble())))
+				return -1;
+			for (i = 0; i < ens->num; i++)
+				if (ens->services[i].id == get_u32(&arg[3]))
+					return sim_lat[LAT_CMD].us;
+			return -1;
+		case SI46XX_DAB_GET_ENSEMBLE_INFO:
+			if ((!chip->valid) || (!(ens = sim_ensemble())))
+				return -1;
+			put_u16(4, ens->id);
+			memset(&chip->reply[6], ' ', 16);
+			memcpy(&chip->reply[6], ens->label, strlen(ens->label));
+			sim_reply(22);
+			return sim_lat[LAT_CMD].us;
+		case SI46XX_DAB_GET_AUDIO_INFO:
+			put_u16(4, 96);
+			put_u16(6, 48000);
+			chip->reply[8] = 0x02;
+			sim_reply(9);
+			return sim_lat[LAT_CMD].us;
+		case SI46XX_DAB_GET_SUBCHAN_INFO:
+			chip->reply[4] = 4;	/* DAB+ */
+			chip->reply[5] = 8;	/* EEP-3A */
+			put_u16(6, 96);
+			put_u16(8, 72);
+			put_u16(10, 0);
+			sim_reply(12);
+			return sim_lat[LAT_CMD].us;
+		case SI46XX_DAB_GET_SERVICE_LINKING_INFO:
+			sim_reply(24);
+			return sim_lat[LAT_CMD].us;
+		}
+	}
+
+	return -1;
+}
+
+static int sim_write(const uint8_t *buf, int len)
+{
+	uint64_t now = sim_now();
+	int lat;
+
+	if (len < 1)
+		return -EINVAL;
+
+	trace_io(TRACE_TX, buf, len);
+
+	if (now < chip->busy_until) {
+		/* command while CTS is low */
+		chip->err = 1;
+		chip->status3 |= SIM_CMDOFERR;
+		return 0;
+	}
+
+	chip->err = 0;
+	chip->status3 = 0;
+	memset(chip->reply, 0, sizeof(chip->reply));
+	sim_reply(4);
+
+	lat = sim_exec(buf[0], buf + 1, len - 1);
+	if (lat < 0) {
+		chip->err = 1;
+		lat = sim_lat[LAT_CMD].us;
+	}
+	chip->busy_until = now + lat;
+
+	return 0;
+}
+
+static int sim_read_reply(uint8_t *data, int cnt)
+{
+	uint64_t now = sim_now();
+	int cts = now >= chip->busy_until;
+
+	if ((chip->stc_at) && (now >= chip->stc_at)) {
+		chip->stcint = 1;
+		chip->stc_at = 0;
+	}
+
+	memset(data, 0, cnt + 1);
+	if (cts && (cnt > 4))
+		memcpy(data + 5, chip->reply + 4,
+			cnt - 4 < SIM_REPLY_MAX - 4 ? cnt - 4 : SIM_REPLY_MAX - 4);
+
+	data[1] = (cts ? 0x80 : 0) | (chip->err ? 0x40 : 0) |
+		(chip->stcint ? 0x01 : 0);
+	if (cnt > 3)
+		data[4] = (chip->pup << 6) | chip->status3;
+	trace_io(TRACE_RX, data + 1, cnt);
+
+	return 0;
+}
+
+const struct si46xx_bus sim_bus = {
+	.name		= "sim",
+	.write		= sim_write,
+	.read_reply	= sim_read_reply,
+};
+
+static int sim_set_option(char *opt, char **file)
+{
+	char *val = strchr(opt, '=');
+	int i;
+
+	if (!val)
+		return -EINVAL;
+	*val++ = 0;
+
+	if (strcmp(opt, "file") == 0) {
+		*file = val;
+		return 0;
+	}
+	if (strcmp(opt, "boot") == 0) {
+		sim_lat[LAT_BOOT_FM].us = atoi(val);
+		sim_lat[LAT_BOOT_DAB].us = atoi(val);
+		sim_lat[LAT_BOOT_AM].us = atoi(val);
+		return 0;
+	}
+	for (i = 0; i < LAT_NUM; i++) {
+		if (strcmp(opt, sim_lat[i].name) == 0) {
+			sim_lat[i].us = atoi(val);
+			return 0;
+		}
+	}
+	printf("sim: unknown option %s\n", opt);
+	return -EINVAL;
+}
+
+int sim_init(const char *spec)
+{
+	char *opts;
+	char *opt;
+	char *save;
+	char *file = NULL;
+	int fd = -1;
+	int ret = 0;
+
+	opts = strdup(spec);
+	if (!opts)
+		return -ENOMEM;
+
+	opt = strchr(opts, ':');
+	if (opt) {
+		for (opt = strtok_r(opt + 1, ",", &save); opt;
+		     opt = strtok_r(NULL, ",", &save)) {
+			ret = sim_set_option(opt, &file);
+			if (ret)
+				goto out;
+		}
+	}
+
+	if (file) {
+		fd = open(file, O_RDWR | O_CREAT, 0644);
+		if ((fd < 0) || (ftruncate(fd, sizeof(*chip)) < 0)) {
+			printf("sim: can not open %s: %s\n", file,
+				strerror(errno));
+			ret = -errno;
+			goto out;
+		}
+		chip = mmap(NULL, sizeof(*chip), PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	} else {
+		chip = mmap(NULL, sizeof(*chip), PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	}
+	if (chip == MAP_FAILED) {
+		chip = NULL;
+		ret = -errno;
+		goto out;
+	}
+
+	if (chip->magic != SIM_MAGIC) {
+		memset(chip, 0, sizeof(*chip));
+		memset(chip->flash, 0xff, SIM_FLASH_SIZE);
+		chip->magic = SIM_MAGIC;
+	}
+
+out:
+	if (fd >= 0)
+		close(fd);
+	free(opts);
+	return ret;
+}
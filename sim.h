@@ -0,0 +1,10 @@
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include "bus.h"
+
+extern const struct si46xx_bus sim_bus;
+
+int sim_init(const char *spec);
+
+#endif /* _SIM_H_ */
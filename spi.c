@@ -8,10 +8,7 @@
 #include <linux/spi/spidev.h>
 
 #include "spi.h"
-
-extern int verbose;
-
-#define VERBOSE()	(verbose > 2)
+#include "trace.h"
 
 #define MIN(a,b)	(a > b ? b : a)
 
@@ -24,84 +21,250 @@ const static uint8_t     spiBPW   = 8 ;
 const static uint16_t    spiDelay = 0 ;
 
 int spi_fd = 0;
-static int spi_speed;
+static int spi_speed[SPI_PHASE_NUM];
+static int spi_phase = SPI_PHASE_BOOT;
+/* SPI_IOC_WR_MAX_SPEED_HZ, highest of phase speeds */
+static int spi_max_speed;
+
+/* spidev message size limit */
+static int spi_bufsiz = SPI_BUFSIZ_DEFAULT;
 
+/* tx source for read-only transfers */
+static const uint8_t spi_zero_page[SPI_ZERO_PAGE_SIZE];
+
+/*
+ * Single transfer, deact releases CS at the end, otherwise CS stays
+ * asserted for the next one
+ */
 int spi_io(unsigned char *out, unsigned char *in, int len, int deact)
 {
+	struct spi_msg msg;
+
+	spi_msg_init(&msg);
+	msg.keep_cs = !deact;
+	spi_msg_add(&msg, out, in, len, 0, spiDelay);
+
+	return spi_msg_send(&msg);
+}
+
+void spi_msg_init(struct spi_msg *msg)
+{
+	memset(msg, 0, sizeof(*msg));
+}
+
+static int spi_contiguous(__u64 prev, __u32 prev_len, const void *buf)
+{
+	if (!prev)
+		return buf == NULL;
+	return (buf != NULL) && (prev + prev_len == (unsigned long)buf);
+}
+
+/*
+ * Append segment to message
+ *	cs_change	release CS after this segment
+ *	delay_usecs	delay after this segment (before CS is released)
+ * Segment continuing the previous one in both buffers, with CS kept and
+ * no delay in between, is merged into it.
+ */
+int spi_msg_add(struct spi_msg *msg, const void *out, void *in, int len,
+	int cs_change, int delay_usecs)
+{
+	struct spi_ioc_transfer *seg;
+
+	if (msg->num) {
+		seg = &msg->seg[msg->num - 1];
+		if ((!seg->cs_change) && (!seg->delay_usecs) &&
+		    (seg->speed_hz == spi_speed[spi_phase]) &&
+		    spi_contiguous(seg->tx_buf, seg->len, out) &&
+		    spi_contiguous(seg->rx_buf, seg->len, in)) {
+			seg->len         += len;
+			seg->delay_usecs  = delay_usecs;
+			seg->cs_change    = cs_change;
+			msg->len += len;
+			return 0;
+		}
+	}
+
+	if (msg->num >= SPI_MSG_MAX_SEGS)
+		return -ENOSPC;
+
+	seg = &msg->seg[msg->num++];
+	seg->tx_buf        = (unsigned long)out;
+	seg->rx_buf        = (unsigned long)in;
+	seg->len           = len;
+	seg->delay_usecs   = delay_usecs;
+	seg->speed_hz      = spi_speed[spi_phase];
+	seg->bits_per_word = spiBPW;
+	seg->cs_change     = cs_change;
+
+	msg->len += len;
+
+	return 0;
+}
+
+static int spi_xfer(struct spi_ioc_transfer *xfer, int num, int len)
+{
+	int ret;
+
+	ret = ioctl(spi_fd, SPI_IOC_MESSAGE(num), xfer);
+	if (ret != len) {
+		printf("SPI message return %d instead of %d: %s\n", ret, len,
+			ret < 0 ? strerror(errno) : "short transfer");
+		return ret < 0 ? -errno : -EIO;
+	}
+	return 0;
+}
+
+/*
+ * spidev bounces whole message through a buffer of bufsiz bytes, so
+ * message is sent as several ioctls of at most bufsiz bytes. Segments
+ * are split where needed. An ioctl ending inside a frame sets cs_change
+ * on its last transfer, which keeps CS asserted into the next one. That
+ * is only a hint, controllers with native CS drop it anyway, so callers
+ * size frames to fit bufsiz (spi_get_bufsiz()) and splitting is a
+ * fallback for oversized messages.
+ */
+int spi_msg_send(struct spi_msg *msg)
+{
+	struct spi_ioc_transfer xfer[SPI_MSG_MAX_SEGS];
+	struct spi_ioc_transfer *seg;
+	struct spi_ioc_transfer *x;
+	int num = 0;
+	int total = 0;
+	int release;
 	int ret;
 	int i;
-	struct spi_ioc_transfer spi[2];
-	char *local_out = NULL;
-
-	memset(spi, 0, sizeof(spi));
-
-	spi[0].tx_buf        = (unsigned long)out;
-	spi[0].rx_buf        = (unsigned long)in;
-	spi[0].len           = len;
-	spi[0].delay_usecs   = spiDelay;
-	spi[0].speed_hz      = spi_speed;
-	spi[0].bits_per_word = spiBPW;
-	spi[0].cs_change     = 1;
-	
-	/* to deactivate CS */
-	spi[1].tx_buf        = 0;
-	spi[1].rx_buf        = 0;
-	spi[1].len           = 0;
-	spi[1].delay_usecs   = spiDelay;
-	spi[1].speed_hz      = spi_speed;
-	spi[1].bits_per_word = spiBPW;
-	spi[1].cs_change     = 1;
-
-	if (VERBOSE()) {
-		if (out) {
-			printf("(%04d)> ", len);
-			for (i = 0; i < MIN(len, 16); i++)
-				printf("%02x ", out[i]);
-			if (i != len)
-				printf("...");
-			printf("\n");
-		} else {
-			printf("(%04d)> NULL\n", len);
+	__u32 done;
+	__u32 piece;
+
+	/* segments continuing a frame carry no opcode */
+	for (i = 0; i < msg->num; i++)
+		trace_io(((i) && (!msg->seg[i - 1].cs_change)) ?
+				TRACE_TX_CONT : TRACE_TX,
+			(uint8_t *)(unsigned long)msg->seg[i].tx_buf,
+			msg->seg[i].len);
+
+	for (i = 0; i < msg->num; i++) {
+		seg = &msg->seg[i];
+		/* CS is released at the end of message unless kept */
+		release = (i == msg->num - 1) ? !msg->keep_cs : seg->cs_change;
+
+		for (done = 0; done < seg->len; done += piece) {
+			piece = MIN(seg->len - done, (__u32)(spi_bufsiz - total));
+
+			x = &xfer[num++];
+			*x = *seg;
+			x->len = piece;
+			if (seg->tx_buf)
+				x->tx_buf += done;
+			else if (piece <= SPI_ZERO_PAGE_SIZE)
+				/* controller shifts out zeroes */
+				x->tx_buf = (unsigned long)spi_zero_page;
+			if (seg->rx_buf)
+				x->rx_buf += done;
+			total += piece;
+
+			if (done + piece < seg->len) {
+				x->cs_change = 0;
+				x->delay_usecs = 0;
+			} else {
+				x->cs_change = release;
+			}
+
+			if ((total < spi_bufsiz) && (num < SPI_MSG_MAX_SEGS) &&
+			    ((i < msg->num - 1) || (done + piece < seg->len)))
+				continue;
+
+			/* last transfer of ioctl: cs_change keeps CS */
+			x->cs_change = !((done + piece == seg->len) && release);
+			ret = spi_xfer(xfer, num, total);
+			if (ret)
+				return ret;
+			num = 0;
+			total = 0;
 		}
 	}
-	/* check if we need this */
-	if (out == NULL) {
-		local_out = malloc(len);
-		memset(local_out, 0, len);
-		spi[0].tx_buf = (unsigned long)local_out;
+	/* trailing empty segments */
+	if (num) {
+		xfer[num - 1].cs_change = msg->keep_cs;
+		ret = spi_xfer(xfer, num, total);
+		if (ret)
+			return ret;
 	}
 
-	if (deact)
-		ret = ioctl(spi_fd, SPI_IOC_MESSAGE(2), spi);
-	else
-		ret = ioctl(spi_fd, SPI_IOC_MESSAGE(1), spi);
-		
-	if (ret != len)
-		printf("SPI write return %d instead of %d\n", ret, len);
-	if (VERBOSE()) {
-		if (in) {
-			printf("(%04d)< ", len);
-			for (i = 0; i < MIN(len, 16); i++)
-				printf("%02x ", in[i]);
-			if (i != len)
-				printf("...");
-			printf("\n");
-		} else {
-			printf("(%04d)< NULL\n", len);
+	for (i = 0; i < msg->num; i++)
+		if (msg->seg[i].rx_buf)
+			trace_io(TRACE_RX, (uint8_t *)(unsigned long)msg->seg[i].rx_buf,
+				msg->seg[i].len);
+
+	return 0;
+}
+
+void spi_set_phase(int phase)
+{
+	if ((phase >= 0) && (phase < SPI_PHASE_NUM))
+		spi_phase = phase;
+}
+
+int spi_get_bufsiz(void)
+{
+	return spi_bufsiz;
+}
+
+int spi_get_speed(int phase)
+{
+	if ((phase < 0) || (phase >= SPI_PHASE_NUM))
+		return -EINVAL;
+	return spi_speed[phase];
+}
+
+/*
+ * Transfers carry their own speed_hz, device max only needs to be
+ * raised when a phase goes above it
+ */
+int spi_set_speed(int phase, int speed)
+{
+	int ret;
+
+	if ((phase < 0) || (phase >= SPI_PHASE_NUM) || (speed <= 0))
+		return -EINVAL;
+
+	if (speed > spi_max_speed) {
+		ret = ioctl(spi_fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed);
+		if (ret < 0) {
+			printf("SPI Speed Change failure: %s\n", strerror(errno));
+			return -errno;
 		}
+		spi_max_speed = speed;
 	}
+	spi_speed[phase] = speed;
 
-	if (local_out)
-		free(local_out);
-
-	//return ret;
 	return 0;
 }
 
+/*
+ * Largest message spidev accepts, module parameter
+ */
+static int spi_read_bufsiz(void)
+{
+	FILE *fp;
+	int val;
+
+	fp = fopen(SPI_BUFSIZ_PATH, "r");
+	if (fp == NULL)
+		return -errno;
+	if (fscanf(fp, "%d", &val) != 1)
+		val = -EIO;
+	fclose(fp);
+
+	return val;
+}
+
 int spi_init(char *path, int speed, int mode)
 {
 	int fd ;
 	int ret;
+	int i;
 	
 	mode &= 3;
 
@@ -112,7 +275,15 @@ int spi_init(char *path, int speed, int mode)
 	}
 
 	spi_fd = fd ;
-	spi_speed = speed;
+	for (i = 0; i < SPI_PHASE_NUM; i++)
+		spi_speed[i] = speed;
+	spi_max_speed = speed;
+
+	ret = spi_read_bufsiz();
+	if (ret > 0)
+		spi_bufsiz = ret;
+	else
+		printf("SPI bufsiz unknown, using %d\n", spi_bufsiz);
 
 	/* Set SPI parameters */
 	ret = ioctl (fd, SPI_IOC_WR_MODE, &mode);
@@ -1,9 +1,44 @@
 #ifndef _SPI_H_
 #define _SPI_H_
 
-int spi_fd;
+#include <stdint.h>
+#include <linux/spi/spidev.h>
+
+#define SPI_MSG_MAX_SEGS	8
+#define SPI_ZERO_PAGE_SIZE	4096
+/* spidev default, actual value is read from module parameter */
+#define SPI_BUFSIZ_DEFAULT	4096
+#define SPI_BUFSIZ_PATH		"/sys/module/spidev/parameters/bufsiz"
+
+/* clock phases, each has own speed */
+#define SPI_PHASE_BOOT		0	/* bootloader: POWER_UP, patch */
+#define SPI_PHASE_LOAD		1	/* HOST_LOAD and flash write blocks */
+#define SPI_PHASE_APP		2	/* firmware running */
+#define SPI_PHASE_NUM		3
+
+/*
+ * Multi-segment SPI message, sent with as few SPI_IOC_MESSAGE ioctls as
+ * spidev bufsiz allows. CS is released after each segment added with
+ * cs_change set and at the end of the message, unless keep_cs is set.
+ */
+struct spi_msg {
+	struct spi_ioc_transfer seg[SPI_MSG_MAX_SEGS];
+	int num;
+	int len;
+	int keep_cs;
+};
+
+extern int spi_fd;
 
 int spi_io(unsigned char *out, unsigned char *in, int len, int deact);
+void spi_msg_init(struct spi_msg *msg);
+int spi_msg_add(struct spi_msg *msg, const void *out, void *in, int len,
+	int cs_change, int delay_usecs);
+int spi_msg_send(struct spi_msg *msg);
+void spi_set_phase(int phase);
+int spi_set_speed(int phase, int speed);
+int spi_get_speed(int phase);
+int spi_get_bufsiz(void);
 int spi_init(char *path, int speed, int mode);
 
 #endif /* _SPI_H_ */
@@ -0,0 +1,162 @@
+/*
+ * Bus trace - fixed size in-memory ring of binary transfer records
+ *
+ * Recording takes a slot with one atomic add and fills it without any
+ * lock or formatting, so tracing can stay on at full speed. A record is
+ * published by storing its sequence number last; the dumper skips slots
+ * that are being written or were overwritten while it read them.
+ *
+ * TX records carry the command opcode (first byte of the frame), RX
+ * records the opcode of the last command sent, i.e. the one the reply
+ * belongs to.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "si46xx.h"
+#include "trace.h"
+
+#define MIN(a,b)	(a > b ? b : a)
+
+struct trace_rec {
+	uint32_t seq;		/* index + 1, 0 while being written */
+	uint8_t dir;
+	uint8_t op;
+	uint16_t len;
+	uint64_t ns;
+	uint8_t data[TRACE_DATA_LEN];
+};
+
+static struct trace_rec trace_ring[TRACE_RING_SIZE];
+static uint32_t trace_head;
+static uint8_t trace_op;
+
+static const struct {
+	uint8_t op;
+	const char *name;
+} trace_cmds[] = {
+	{ SI46XX_RD_REPLY,			"RD_REPLY" },
+	{ SI46XX_POWER_UP,			"POWER_UP" },
+	{ SI46XX_HOST_LOAD,			"HOST_LOAD" },
+	{ SI46XX_FLASH_LOAD,			"FLASH_LOAD" },
+	{ SI46XX_LOAD_INIT,			"LOAD_INIT" },
+	{ SI46XX_BOOT,				"BOOT" },
+	{ SI46XX_GET_PART_INFO,			"GET_PART_INFO" },
+	{ SI46XX_GET_SYS_STATE,			"GET_SYS_STATE" },
+	{ SI46XX_GET_FUNC_INFO,			"GET_FUNC_INFO" },
+	{ SI46XX_SET_PROPERTY,			"SET_PROPERTY" },
+	{ SI46XX_GET_PROPERTY,			"GET_PROPERTY" },
+	{ SI46XX_FM_TUNE_FREQ,			"FM_TUNE_FREQ" },
+	{ SI46XX_FM_SEEK_START,			"FM_SEEK_START" },
+	{ SI46XX_FM_RSQ_STATUS,			"FM_RSQ_STATUS" },
+	{ SI46XX_FM_ACF_STATUS,			"FM_ACF_STATUS" },
+	{ SI46XX_FM_RDS_STATUS,			"FM_RDS_STATUS" },
+	{ SI46XX_FM_RDS_BLOCKCOUNT,		"FM_RDS_BLOCKCOUNT" },
+	{ SI46XX_AM_TUNE_FREQ,			"AM_TUNE_FREQ" },
+	{ SI46XX_AM_SEEK_START,			"AM_SEEK_START" },
+	{ SI46XX_AM_RSQ_STATUS,			"AM_RSQ_STATUS" },
+	{ SI46XX_DAB_GET_DIGITAL_SERVICE_LIST,	"DAB_GET_DIGITAL_SERVICE_LIST" },
+	{ SI46XX_DAB_START_DIGITAL_SERVICE,	"DAB_START_DIGITAL_SERVICE" },
+	{ SI46XX_DAB_TUNE_FREQ,			"DAB_TUNE_FREQ" },
+	{ SI46XX_DAB_DIGRAD_STATUS,		"DAB_DIGRAD_STATUS" },
+	{ SI46XX_DAB_GET_ENSEMBLE_INFO,		"DAB_GET_ENSEMBLE_INFO" },
+	{ SI46XX_DAB_GET_SERVICE_LINKING_INFO,	"DAB_GET_SERVICE_LINKING_INFO" },
+	{ SI46XX_DAB_SET_FREQ_LIST,		"DAB_SET_FREQ_LIST" },
+	{ SI46XX_DAB_GET_AUDIO_INFO,		"DAB_GET_AUDIO_INFO" },
+	{ SI46XX_DAB_GET_SUBCHAN_INFO,		"DAB_GET_SUBCHAN_INFO" },
+};
+
+const char *trace_cmd_name(uint8_t op)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(trace_cmds) / sizeof(trace_cmds[0]); i++)
+		if (trace_cmds[i].op == op)
+			return trace_cmds[i].name;
+	return "?";
+}
+
+void trace_io(int dir, const uint8_t *buf, int len)
+{
+	uint32_t idx = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+	struct trace_rec *rec = &trace_ring[idx & (TRACE_RING_SIZE - 1)];
+	struct timespec ts;
+	uint8_t op;
+
+	__atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	if ((dir == TRACE_TX) && (buf) && (len > 0)) {
+		op = buf[0];
+		if (op != SI46XX_RD_REPLY)
+			__atomic_store_n(&trace_op, op, __ATOMIC_RELAXED);
+	} else {
+		op = __atomic_load_n(&trace_op, __ATOMIC_RELAXED);
+	}
+
+	rec->ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	rec->dir = dir;
+	rec->op = op;
+	rec->len = len;
+	if (buf)
+		memcpy(rec->data, buf, MIN(len, TRACE_DATA_LEN));
+
+	__atomic_store_n(&rec->seq, idx + 1, __ATOMIC_RELEASE);
+}
+
+/* print last num records, oldest first */
+void trace_dump(int num)
+{
+	uint32_t head = __atomic_load_n(&trace_head, __ATOMIC_ACQUIRE);
+	uint32_t idx;
+	uint64_t start = 0;
+	struct trace_rec rec;
+	int i;
+
+	if ((num <= 0) || (num > TRACE_RING_SIZE))
+		num = TRACE_RING_SIZE;
+	if ((uint32_t)num > head)
+		num = head;
+
+	printf("bus trace, %d of %u transfers:\n", num, head);
+	for (idx = head - num; idx != head; idx++) {
+		struct trace_rec *slot = &trace_ring[idx & (TRACE_RING_SIZE - 1)];
+
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != idx + 1)
+			continue;
+		memcpy(&rec, slot, sizeof(rec));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != idx + 1)
+			continue;
+
+		if (!start)
+			start = rec.ns;
+		printf("%10.3fms %c %-28s (%04d)",
+			(rec.ns - start) / 1000000.0,
+			rec.dir == TRACE_TX ? '>' :
+				(rec.dir == TRACE_TX_CONT ? '+' : '<'),
+			trace_cmd_name(rec.op), rec.len);
+		for (i = 0; i < MIN(rec.len, TRACE_DATA_LEN); i++)
+			printf(" %02x", rec.data[i]);
+		if (rec.len > TRACE_DATA_LEN)
+			printf(" ...");
+		printf("\n");
+	}
+}
+
+static void trace_dump_all(void)
+{
+	trace_dump(TRACE_RING_SIZE);
+}
+
+void trace_dump_at_exit(void)
+{
+	static int registered;
+
+	if (!registered)
+		atexit(trace_dump_all);
+	registered = 1;
+}
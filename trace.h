@@ -0,0 +1,22 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+
+/* records, must be power of 2 */
+#define TRACE_RING_SIZE		1024
+/* bytes of each transfer kept */
+#define TRACE_DATA_LEN		16
+/* records dumped on error */
+#define TRACE_ERR_RECORDS	16
+
+#define TRACE_TX		0
+#define TRACE_RX		1
+#define TRACE_TX_CONT		2	/* rest of frame sent as own segment */
+
+void trace_io(int dir, const uint8_t *buf, int len);
+void trace_dump(int num);
+void trace_dump_at_exit(void);
+const char *trace_cmd_name(uint8_t op);
+
+#endif /* _TRACE_H_ */
@@ -0,0 +1,38 @@
+/*
+ * Waiting on CLOCK_MONOTONIC deadlines, all times in us
+ */
+#include <errno.h>
+#include <time.h>
+
+#include "wait.h"
+
+uint64_t wait_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void wait_until(uint64_t deadline)
+{
+	struct timespec ts;
+	uint64_t wake;
+
+	if (deadline > wait_now() + WAIT_SPIN_US) {
+		wake = deadline - WAIT_SPIN_US;
+		ts.tv_sec = wake / 1000000;
+		ts.tv_nsec = (wake % 1000000) * 1000;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+				&ts, NULL) == EINTR)
+			;
+	}
+	while (wait_now() < deadline)
+		;
+}
+
+void wait_us(int us)
+{
+	if (us > 0)
+		wait_until(wait_now() + us);
+}
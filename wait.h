@@ -0,0 +1,16 @@
+#ifndef _WAIT_H_
+#define _WAIT_H_
+
+#include <stdint.h>
+
+/*
+ * clock_nanosleep() wakes up 50-100us late, shorter waits are spun and
+ * longer ones sleep up to this much before the deadline and spin the rest
+ */
+#define WAIT_SPIN_US		100
+
+uint64_t wait_now(void);
+void wait_until(uint64_t deadline);
+void wait_us(int us);
+
+#endif /* _WAIT_H_ */